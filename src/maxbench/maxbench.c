@@ -0,0 +1,674 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "maxmsg.h"
+#include "max.h"
+#include "base64.h"
+#include "maxlog.h"
+#include "max_parser.h"
+#include "simconf.h"
+
+/* Declare this as extern to avoid make it public in the headers */
+extern int parseMAXData(char *MAXData, int size, MAX_msg_list** msg_list);
+
+/* Device counts of the synthetic Hello bursts, can be set with -n */
+#define MAX_DEV_COUNTS 32
+static int dev_counts[MAX_DEV_COUNTS] = {1, 2, 5, 10, 20, 50, 100, 200, 500};
+static int ndev_counts = 9;
+
+/* Largest burst build_hello can make */
+#define BENCH_MAX_DEVS 500
+
+/* Minimum measuring time per test in ns */
+#define BENCH_MIN_NS 200000000ULL
+
+/* Results are also written to this file as CSV with -c */
+static FILE *csv = NULL;
+
+/* Allocations made by the code under test. The bench is linked with
+ * --wrap=malloc,--wrap=calloc,--wrap=realloc so the calls of our objects
+ * end up here, the ones made inside libc are not counted. */
+static long allocs = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    allocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+
+/* Print one result. 'n' is the device count or the data size of the test,
+ * 'items' the messages, devices or bytes handled by one operation. */
+static void report(const char *test, const char *variant, int n, int items,
+        uint64_t elapsed, long iter, long nalloc)
+{
+    double ns_op = (double)elapsed / iter;
+    double ns_item = ns_op / items;
+    double alloc_item = (double)nalloc / iter / items;
+    double items_s = 1e9 / ns_item;
+
+    printf("%-6s %-7s %5d %6d %12.0f %10.2f %8.2f %12.0f\n", test, variant,
+           n, items, ns_op, ns_item, alloc_item, items_s);
+    if (csv != NULL)
+    {
+        fprintf(csv, "%s,%s,%d,%d,%.1f,%.3f,%.3f,%.0f\n", test, variant,
+                n, items, ns_op, ns_item, alloc_item, items_s);
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Append message type, payload encoded in base64 and terminator */
+static size_t put_b64_msg(char *out, const char *prefix,
+        const unsigned char *data, size_t data_sz)
+{
+    size_t len = strlen(prefix);
+
+    memcpy(out, prefix, len);
+    len += hex_to_base64_buf(data, data_sz, out + len,
+                             BASE64_ENCODED_SZ(data_sz));
+    memcpy(out + len, MSG_END, MSG_END_LEN);
+    return len + MSG_END_LEN;
+}
+
+/* Build a Hello burst (H, M, C for the cube and every device, L) as sent by a
+ * cube with 'ndev' radiator thermostats */
+static char* build_hello(int ndev, size_t *size, int *nmsg)
+{
+    char *burst, *p, prefix[16];
+    unsigned char c_data[sizeof(union C_Data_Device) +
+                         sizeof(((union C_Data_Config*)0)->rtc)];
+    unsigned char *l_data, *l;
+    int i;
+
+    burst = malloc(1024 + ndev * 400);
+    l_data = malloc(ndev * 12 + 1);
+    p = burst;
+    p += sprintf(p, "H:KEQ0523864,0b6444,0113,00000000,4c4e0e3d,00,32,"
+                    "0f0b0a,1126,03,0000" MSG_END);
+    p += sprintf(p, "M:00,01,VgIBAQpMaXZpbmdyb29tAQAAAA==" MSG_END);
+    memset(c_data, 0, sizeof(c_data));
+    c_data[0] = sizeof(union C_Data_Device) - 1;
+    c_data[1] = 0x0b; c_data[2] = 0x64; c_data[3] = 0x44;
+    memcpy(c_data + 8, "KEQ0523864", 10);
+    p += put_b64_msg(p, "C:0b6444,", c_data, sizeof(union C_Data_Device) + 68);
+    l = l_data;
+    for (i = 0; i < ndev; i++)
+    {
+        uint32_t rf = SIM_DEVICE_RF + i;
+        union C_Data_Device *dev = (union C_Data_Device*)c_data;
+        union C_Data_Config *cfg =
+            (union C_Data_Config*)(c_data + sizeof(union C_Data_Device));
+        int d, s;
+
+        memset(c_data, 0, sizeof(c_data));
+        dev->device.Data_Length[0] = sizeof(c_data) - 1;
+        dev->device.Address_of_device[0] = rf >> 16;
+        dev->device.Address_of_device[1] = rf >> 8;
+        dev->device.Address_of_device[2] = rf;
+        dev->device.Device_Type[0] = RadiatorThermostat;
+        dev->device.Room_ID[0] = i % 8 + 1;
+        snprintf(dev->device.Serial_Number, sizeof(c_data) - 8, "KEQ%07d", i);
+        cfg->rtc.Comfort_Temperature[0] = 45;
+        cfg->rtc.Eco_Temperature[0] = 38;
+        for (d = 0; d < 7; d++)
+        {
+            unsigned char *wp = &cfg->rtc.Weekly_Program[d * 26];
+            /* 20.0 until 06:30, then 22.5 until 24:00 */
+            wp[0] = 40 << 1;
+            wp[1] = 78;
+            for (s = 2; s < 26; s += 2)
+            {
+                wp[s] = (45 << 1) | 1;
+                wp[s + 1] = 0x20;
+            }
+        }
+        sprintf(prefix, "C:%06x,", rf);
+        p += put_b64_msg(p, prefix, c_data, sizeof(c_data));
+        /* Device list entry */
+        l[0] = 11;
+        l[1] = rf >> 16; l[2] = rf >> 8; l[3] = rf;
+        l[4] = 0; l[5] = 0x12; l[6] = 0x18;
+        l[7] = i % 100; l[8] = 40; l[9] = 0; l[10] = 215; l[11] = 0;
+        l += 12;
+    }
+    p += put_b64_msg(p, "L:", l_data, l - l_data);
+    free(l_data);
+    *size = p - burst;
+    *nmsg = ndev + 4;
+    return burst;
+}
+
+static const char *decode_mode_name[] = {"eager", "lazy"};
+
+/* Parse a Hello burst and read the device list, like 'log' does */
+static void bench_parse(int ndev, int mode)
+{
+    MAX_msg_list *msg_list;
+    uint64_t start, elapsed;
+    size_t size;
+    long iter = 0;
+    int nmsg;
+    char *burst = build_hello(ndev, &size, &nmsg);
+
+    setMAXDecodeMode(mode);
+    allocs = 0;
+    start = now_ns();
+    do {
+        msg_list = NULL;
+        parseMAXData(burst, size, &msg_list);
+        getMAXmsg(msg_list->last);
+        freeMAXpkt(&msg_list);
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("parse", decode_mode_name[mode], ndev, nmsg, elapsed, iter, allocs);
+    free(burst);
+}
+
+/* Look up the config message of every device of a Hello burst, with the
+ * packet index or with a list search */
+static void bench_lookup(int ndev, int use_index)
+{
+    MAX_msg_list *msg_list = NULL, *start_msg;
+    uint64_t start, elapsed;
+    size_t size;
+    long iter = 0;
+    int nmsg, i;
+    char *burst = build_hello(ndev, &size, &nmsg);
+
+    parseMAXData(burst, size, &msg_list);
+    /* Starting after the first element bypasses the index */
+    start_msg = use_index ? msg_list : msg_list->next;
+    allocs = 0;
+    start = now_ns();
+    do {
+        for (i = 0; i < ndev; i++)
+        {
+            if (findMAXConfig(SIM_DEVICE_RF + i, start_msg) == NULL)
+            {
+                printf("findMAXConfig failed for device %d\n", i);
+                exit(1);
+            }
+        }
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("lookup", use_index ? "index" : "list", ndev, ndev, elapsed, iter,
+           allocs);
+    freeMAXpkt(&msg_list);
+    free(burst);
+}
+
+/* Write the device list of a Hello burst as a text log sample */
+static void bench_log_text(int ndev)
+{
+    MAX_msg_list *msg_list = NULL;
+    uint64_t start, elapsed;
+    size_t size;
+    long iter = 0;
+    int nmsg;
+    char *burst = build_hello(ndev, &size, &nmsg);
+    FILE *fp = fopen("/dev/null", "w");
+
+    if (fp == NULL)
+    {
+        free(burst);
+        return;
+    }
+    parseMAXData(burst, size, &msg_list);
+    allocs = 0;
+    start = now_ns();
+    do {
+        logMAXHostDeviceList(fp, msg_list->last);
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("log", "text", ndev, ndev, elapsed, iter, allocs);
+    fclose(fp);
+    freeMAXpkt(&msg_list);
+    free(burst);
+}
+
+static const char *log_format_name[] = {"", "bin", "delta"};
+
+/* Decode the device list of a Hello burst into 'state' */
+static int hello_states(int ndev, struct MAX_device_state *state)
+{
+    MAX_msg_list *msg_list = NULL;
+    size_t size;
+    int nmsg, count;
+    char *burst = build_hello(ndev, &size, &nmsg);
+
+    parseMAXData(burst, size, &msg_list);
+    count = decodeMAXDeviceList(msg_list->last, state, ndev);
+    freeMAXpkt(&msg_list);
+    free(burst);
+    return count;
+}
+
+/* Append samples to a binary log. A valve moves between two samples, like
+ * on a quiet system. */
+static void bench_log_append(int ndev, enum MAXLogFormat format)
+{
+    struct MAX_device_state state[BENCH_MAX_DEVS];
+    MAX_log_writer *log;
+    uint64_t start, elapsed;
+    long iter = 0;
+
+    if (ndev > MAX_LOG_DEVICES || hello_states(ndev, state) != ndev ||
+        (log = openMAXLog("/dev/null", format)) == NULL)
+    {
+        return;
+    }
+    allocs = 0;
+    start = now_ns();
+    do {
+        state[iter % ndev].valve ^= 1;
+        appendMAXLog(log, iter, state, ndev);
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("log", log_format_name[format], ndev, ndev, elapsed, iter, allocs);
+    closeMAXLog(log);
+}
+
+/* Samples in the log read by bench_log_decode */
+#define BENCH_LOG_SAMPLES 256
+
+/* Decode every sample of a binary log */
+static void bench_log_decode(int ndev, enum MAXLogFormat format)
+{
+    struct MAX_device_state state[BENCH_MAX_DEVS];
+    static MAX_log_decoder dec;
+    MAX_log_writer *log;
+    MAX_log_map map;
+    char path[] = "/tmp/maxbenchXXXXXX";
+    uint64_t start, elapsed;
+    long iter = 0;
+    int fd, i, res;
+
+    if (ndev > MAX_LOG_DEVICES || hello_states(ndev, state) != ndev ||
+        (fd = mkstemp(path)) < 0)
+    {
+        return;
+    }
+    close(fd);
+    log = openMAXLog(path, format);
+    for (i = 0; log != NULL && i < BENCH_LOG_SAMPLES; i++)
+    {
+        state[i % ndev].valve ^= 1;
+        appendMAXLog(log, i, state, ndev);
+    }
+    if (log != NULL)
+    {
+        closeMAXLog(log);
+    }
+    res = mapMAXLog(path, &map);
+    unlink(path);
+    if (log == NULL || res < 0)
+    {
+        return;
+    }
+    allocs = 0;
+    start = now_ns();
+    do {
+        initMAXLogDecoder(&dec, &map, 0);
+        i = 0;
+        while (nextMAXLogSample(&dec) > 0)
+        {
+            i++;
+        }
+        if (i != BENCH_LOG_SAMPLES)
+        {
+            printf("log decode failed after %d samples\n", i);
+            exit(1);
+        }
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("logdec", log_format_name[format], ndev, ndev * BENCH_LOG_SAMPLES,
+           elapsed, iter, allocs);
+    unmapMAXLog(&map);
+}
+
+/* Build a configuration file for the devices of build_hello. Every other
+ * device has its monday program changed. */
+static char* build_config(int ndev, size_t *size)
+{
+    char *conf = NULL;
+    FILE *fp = open_memstream(&conf, size);
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    write_sim_config(fp, ndev, 8, 2);
+    fclose(fp);
+    return conf;
+}
+
+/* Compare the rule set of a configuration file with a Hello burst, like
+ * 'program' does before sending the changes */
+static void bench_flag(int ndev)
+{
+    MAX_msg_list *msg_list = NULL;
+    struct ruleset *rs = NULL;
+    uint64_t start, elapsed;
+    size_t size, conf_size;
+    long iter = 0;
+    int nmsg, res;
+    char *burst = build_hello(ndev, &size, &nmsg);
+    char *conf = build_config(ndev, &conf_size);
+    FILE *fp = fmemopen(conf, conf_size, "r");
+
+    res = (fp != NULL) ? parse_file(fp, &rs) : -1;
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    if (res < 0 || rs == NULL)
+    {
+        printf("cannot parse the configuration of %d devices\n", ndev);
+        exit(1);
+    }
+    parseMAXData(burst, size, &msg_list);
+    allocs = 0;
+    start = now_ns();
+    do {
+        walklist((union cfglist*)rs, flag_ruleset, msg_list);
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("flag", "ruleset", ndev, ndev, elapsed, iter, allocs);
+    walklist((union cfglist*)rs, free_ruleset, NULL);
+    freeMAXpkt(&msg_list);
+    free(conf);
+    free(burst);
+}
+
+static const char *decoder_name[] = {"scalar", "ssse3", "avx2"};
+
+/* Check that all the base64 decoders supported by the CPU give the same
+ * output as the scalar one. Return the number of mismatches. */
+static int check_base64(void)
+{
+    unsigned char data[1024];
+    int len, n, type, errors = 0;
+
+    srand(1);
+    for (len = 1; len < sizeof(data); len++)
+    {
+        char *b64;
+        unsigned char *ref;
+        size_t b64_len, ref_len;
+
+        for (n = 0; n < len; n++)
+        {
+            data[n] = rand();
+        }
+        b64 = hex_to_base64(data, len, 0, 0, &b64_len);
+        base64_set_decoder(Base64Scalar);
+        ref = base64_to_hex(b64, b64_len, 3, 0, &ref_len);
+        for (type = Base64SSSE3; type <= Base64AVX2; type++)
+        {
+            unsigned char *out;
+            size_t out_len;
+
+            if (base64_set_decoder(type) != 0)
+            {
+                continue;
+            }
+            out = base64_to_hex(b64, b64_len, 3, 0, &out_len);
+            if (out_len != ref_len || memcmp(out + 3, ref + 3, ref_len) != 0 ||
+                ref_len != len || memcmp(ref + 3, data, len) != 0)
+            {
+                printf("base64 %s decoder mismatch, length %d\n",
+                       decoder_name[type], len);
+                errors++;
+            }
+            free(out);
+        }
+        free(ref);
+        free(b64);
+    }
+    return errors;
+}
+
+static void bench_base64(int type, size_t data_sz)
+{
+    unsigned char data[4096], out[4096];
+    uint64_t start, elapsed;
+    long iter = 0;
+    size_t b64_len;
+    char *b64;
+    int n;
+
+    if (base64_set_decoder(type) != 0)
+    {
+        return;
+    }
+    for (n = 0; n < data_sz; n++)
+    {
+        data[n] = rand();
+    }
+    b64 = hex_to_base64(data, data_sz, 0, 0, &b64_len);
+    allocs = 0;
+    start = now_ns();
+    do {
+        base64_to_hex_buf(b64, b64_len, out, sizeof(out));
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("b64dec", decoder_name[type], data_sz, data_sz, elapsed, iter,
+           allocs);
+    free(b64);
+}
+
+/* Encode like the commands sent to the cube, in an allocated or in a
+ * caller buffer */
+static void bench_base64_enc(int use_buf, size_t data_sz)
+{
+    unsigned char data[4096];
+    char out[BASE64_ENCODED_SZ(4096)];
+    uint64_t start, elapsed;
+    long iter = 0;
+    size_t b64_len;
+    int n;
+
+    for (n = 0; n < data_sz; n++)
+    {
+        data[n] = rand();
+    }
+    allocs = 0;
+    start = now_ns();
+    do {
+        if (use_buf)
+        {
+            hex_to_base64_buf(data, data_sz, out, sizeof(out));
+        }
+        else
+        {
+            free(hex_to_base64(data, data_sz, 0, 0, &b64_len));
+        }
+        iter++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    report("b64enc", use_buf ? "buf" : "alloc", data_sz, data_sz, elapsed,
+           iter, allocs);
+}
+
+/* Parse a comma separated list of device counts */
+static int read_dev_counts(const char *arg)
+{
+    char *end;
+    long n;
+
+    ndev_counts = 0;
+    while (*arg != '\0' && ndev_counts < MAX_DEV_COUNTS)
+    {
+        n = strtol(arg, &end, 10);
+        if (end == arg || n < 1 || n > BENCH_MAX_DEVS ||
+            (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        dev_counts[ndev_counts++] = n;
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return (ndev_counts > 0 && *arg == '\0') ? 0 : -1;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-n count[,count...]] [-c file.csv]\n"
+           "  -n  device counts of the Hello bursts, 1 to %d\n"
+           "  -c  also write the results to a CSV file\n",
+           name, BENCH_MAX_DEVS);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, type, best, opt;
+    size_t sizes[2];
+
+    while ((opt = getopt(argc, argv, "n:c:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            if (read_dev_counts(optarg) < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            if ((csv = fopen(optarg, "w")) == NULL)
+            {
+                perror(optarg);
+                return 1;
+            }
+            fprintf(csv, "test,variant,n,items,ns_per_op,ns_per_item,"
+                         "allocs_per_item,items_per_s\n");
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Items are messages for parse, devices or device samples for the
+     * others and bytes for base64 */
+    printf("%-6s %-7s %5s %6s %12s %10s %8s %12s\n", "test", "variant", "n",
+           "items", "ns/op", "ns/item", "alloc/i", "items/s");
+    for (i = 0; i < ndev_counts; i++)
+    {
+        bench_parse(dev_counts[i], MAXDecodeEager);
+        bench_parse(dev_counts[i], MAXDecodeLazy);
+    }
+    setMAXDecodeMode(MAXDecodeEager);
+    for (i = 0; i < ndev_counts; i++)
+    {
+        bench_lookup(dev_counts[i], 0);
+        bench_lookup(dev_counts[i], 1);
+    }
+    for (i = 0; i < ndev_counts; i++)
+    {
+        bench_flag(dev_counts[i]);
+    }
+    for (i = 0; i < ndev_counts; i++)
+    {
+        bench_log_text(dev_counts[i]);
+        bench_log_append(dev_counts[i], MAXLogFixed);
+        bench_log_append(dev_counts[i], MAXLogDelta);
+    }
+    for (i = 0; i < ndev_counts; i++)
+    {
+        bench_log_decode(dev_counts[i], MAXLogFixed);
+        bench_log_decode(dev_counts[i], MAXLogDelta);
+    }
+
+    best = base64_decoder();
+    if (check_base64() != 0)
+    {
+        return 1;
+    }
+    /* Size of a decoded thermostat 'C' message and of a large 'L' one */
+    sizes[0] = sizeof(union C_Data_Device) +
+        sizeof(((union C_Data_Config*)0)->rtc);
+    sizes[1] = 3000;
+    for (i = 0; i < 2; i++)
+    {
+        for (type = Base64Scalar; type <= Base64AVX2; type++)
+        {
+            bench_base64(type, sizes[i]);
+        }
+    }
+    base64_set_decoder(best);
+    for (i = 0; i < 2; i++)
+    {
+        bench_base64_enc(0, sizes[i]);
+        bench_base64_enc(1, sizes[i]);
+    }
+
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return 0;
+}
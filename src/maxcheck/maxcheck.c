@@ -0,0 +1,316 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "base64.h"
+
+/* Check that every base64 decoder supported by the CPU gives the output of
+ * the original scalar code, on random data of all lengths up to
+ * CHECK_MAX_LEN, on inputs of invalid length and on inputs with a char
+ * outside of the alphabet. Run by 'make check', exit code 1 on mismatch. */
+
+#define CHECK_MAX_LEN 300  /* Longest data, in bytes, checked */
+#define CHECK_ROUNDS 8     /* Random data sets per length */
+
+static const char *decoder_name[] = {"scalar", "ssse3", "avx2"};
+
+/* Reference encoder and decoder, the code of hex_to_base64 and base64_to_hex
+ * before the decoders were vectorized. The inverse table is zeroed, not left
+ * uninitialized, and the decoder is only given inputs of valid length. */
+static char ref_index_table[] =
+    {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+     'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+     'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+     'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
+static char ref_inv_index_table[256];
+
+static void ref_create_inv_index_table(void)
+{
+    int i;
+
+    for (i = 0; i < 64; i++)
+    {
+        ref_inv_index_table[(unsigned char) ref_index_table[i]] = i;
+    }
+}
+
+static char *ref_hex_to_base64(const unsigned char *data, size_t data_sz,
+        size_t *output_sz)
+{
+    int i, j;
+    char *base64_text;
+
+    *output_sz = 4 * ((data_sz + 2) / 3);
+    base64_text = malloc(*output_sz + 1);
+    if (base64_text == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0, j = 0; i < data_sz;)
+    {
+        uint32_t B0, B1, B2, tmp;
+
+        B0 = (i < data_sz) ? (unsigned char)data[i++] : 0;
+        B1 = (i < data_sz) ? (unsigned char)data[i++] : 0;
+        B2 = (i < data_sz) ? (unsigned char)data[i++] : 0;
+        tmp = (B0 << 16) + (B1 << 8) + B2;
+
+        base64_text[j++] = ref_index_table[(tmp >> 18) & 0b00111111];
+        base64_text[j++] = ref_index_table[(tmp >> 12) & 0b00111111];
+        base64_text[j++] = ref_index_table[(tmp >> 6) & 0b00111111];
+        base64_text[j++] = ref_index_table[tmp & 0b00111111];
+    }
+
+    j = data_sz % 3;
+    if (j != 0)
+    {
+        j = 3 - j;
+        for (i = 0; i < j; i++)
+        {
+            base64_text[*output_sz - 1 - i] = '=';
+        }
+    }
+
+    return base64_text;
+}
+
+static unsigned char *ref_base64_to_hex(const char *data, size_t data_sz,
+        size_t *output_sz)
+{
+    unsigned char *hex_data;
+    int i, j;
+
+    *output_sz = data_sz / 4 * 3;
+    if (data[data_sz - 1] == '=')
+    {
+        (*output_sz)--;
+    }
+    if (data[data_sz - 2] == '=')
+    {
+        (*output_sz)--;
+    }
+
+    hex_data = malloc(*output_sz + 1);
+    if (hex_data == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0, j = 0; i < data_sz;)
+    {
+        uint32_t tmp = 0, k;
+
+        for (k = 0; k < 4; k++)
+        {
+            tmp = (tmp << 6);
+            tmp |= (data[i] == '=') ? 0 : ref_inv_index_table[(int)data[i]];
+            i++;
+        }
+
+        if (j < *output_sz)
+        {
+            hex_data[j++] = (tmp >> 16) & 0xFF;
+        }
+        if (j < *output_sz)
+        {
+            hex_data[j++] = (tmp >> 8) & 0xFF;
+        }
+        if (j < *output_sz)
+        {
+            hex_data[j++] = tmp & 0xFF;
+        }
+    }
+
+    return hex_data;
+}
+
+/* Decode 'b64' with the decoder in use and compare with the reference.
+ * Return 1 on mismatch. */
+static int check_decode(const char *b64, size_t b64_len, const char *what)
+{
+    unsigned char out[CHECK_MAX_LEN + 64];
+    unsigned char *ref;
+    size_t ref_len;
+    int len;
+
+    len = base64_to_hex_buf(b64, b64_len, out, sizeof(out));
+    if (b64_len == 0)
+    {
+        /* The reference reads before the input, nothing to decode anyway */
+        ref = NULL;
+        ref_len = 0;
+    }
+    else if ((ref = ref_base64_to_hex(b64, b64_len, &ref_len)) == NULL)
+    {
+        printf("out of memory\n");
+        exit(1);
+    }
+    if (len != ref_len || memcmp(out, ref, ref_len) != 0)
+    {
+        printf("base64 %s decoder mismatch, %s, %zu chars\n",
+               decoder_name[base64_decoder()], what, b64_len);
+        free(ref);
+        return 1;
+    }
+    free(ref);
+    return 0;
+}
+
+/* Return 1 if the decoder in use accepts 'b64' */
+static int check_reject(const char *b64, size_t b64_len, const char *what)
+{
+    unsigned char out[CHECK_MAX_LEN + 64];
+
+    if (base64_to_hex_buf(b64, b64_len, out, sizeof(out)) >= 0)
+    {
+        printf("base64 %s decoder accepts %s, %zu chars\n",
+               decoder_name[base64_decoder()], what, b64_len);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_decoder(void)
+{
+    unsigned char data[CHECK_MAX_LEN];
+    int len, round, n, errors = 0;
+
+    srand(1);
+    for (len = 0; len <= CHECK_MAX_LEN; len++)
+    {
+        for (round = 0; round < CHECK_ROUNDS; round++)
+        {
+            char *b64;
+            size_t b64_len, pos;
+            char saved;
+            int bad;
+
+            for (n = 0; n < len; n++)
+            {
+                data[n] = rand();
+            }
+            if ((b64 = ref_hex_to_base64(data, len, &b64_len)) == NULL)
+            {
+                printf("out of memory\n");
+                exit(1);
+            }
+            errors += check_decode(b64, b64_len, "random data");
+
+            /* Truncated, the reference rejects any length not a multiple
+             * of 4 */
+            for (n = 1; n < 4 && n <= b64_len; n++)
+            {
+                errors += check_reject(b64, b64_len - n, "a bad length");
+            }
+
+            if (b64_len == 0)
+            {
+                free(b64);
+                continue;
+            }
+            /* '=' is decoded as 0 wherever it is, vectorized decoders stop
+             * on it and leave the rest to the scalar code */
+            pos = rand() % b64_len;
+            saved = b64[pos];
+            b64[pos] = '=';
+            errors += check_decode(b64, b64_len, "'=' inside");
+
+            /* Any other char outside of the alphabet is an error */
+            do
+            {
+                bad = rand() & 0xff;
+            } while (bad == '=' || bad == '+' || bad == '/' ||
+                     (bad >= '0' && bad <= '9') || (bad >= 'A' && bad <= 'Z') ||
+                     (bad >= 'a' && bad <= 'z'));
+            b64[pos] = (char)bad;
+            errors += check_reject(b64, b64_len, "an invalid char");
+            b64[pos] = saved;
+            free(b64);
+        }
+    }
+    return errors;
+}
+
+/* The encoder has a single implementation, checked against the reference
+ * once */
+static int check_encoder(void)
+{
+    unsigned char data[CHECK_MAX_LEN];
+    char out[BASE64_ENCODED_SZ(CHECK_MAX_LEN)];
+    int len, n, errors = 0;
+
+    srand(2);
+    for (len = 0; len <= CHECK_MAX_LEN; len++)
+    {
+        char *ref;
+        size_t ref_len;
+
+        for (n = 0; n < len; n++)
+        {
+            data[n] = rand();
+        }
+        if ((ref = ref_hex_to_base64(data, len, &ref_len)) == NULL)
+        {
+            printf("out of memory\n");
+            exit(1);
+        }
+        n = hex_to_base64_buf(data, len, out, sizeof(out));
+        if (n != ref_len || memcmp(out, ref, ref_len) != 0)
+        {
+            printf("base64 encoder mismatch, %d bytes\n", len);
+            errors++;
+        }
+        free(ref);
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    int type, errors;
+
+    ref_create_inv_index_table();
+    errors = check_encoder();
+    for (type = Base64Scalar; type <= Base64AVX2; type++)
+    {
+        if (base64_set_decoder(type) != 0)
+        {
+            printf("base64 %s decoder: not supported, skipped\n",
+                   decoder_name[type]);
+            continue;
+        }
+        errors += check_decoder();
+        printf("base64 %s decoder: checked\n", decoder_name[type]);
+    }
+    if (errors > 0)
+    {
+        printf("%d base64 checks failed\n", errors);
+        return 1;
+    }
+    printf("base64 checks passed\n");
+    return 0;
+}
@@ -0,0 +1,216 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "cube_cache.h"
+
+#define CACHE_FILE ".maxctl_cubes"
+#define CACHE_MAX 64 /* Most cubes kept in the cache */
+
+/* One line of the cache file:
+ * <serial> <IP address> <RF address> <firmware> <time of discovery> */
+struct cache_entry {
+    char serial[sizeof(((struct Discover_Data*)0)->Serial_number) + 1];
+    char addr[INET_ADDRSTRLEN];
+    unsigned int rf_address;
+    unsigned int firmware;
+    long stamp;
+};
+
+static int cache_path(char *path, size_t size)
+{
+    const char *env = getenv("MAXCTL_CACHE");
+    const char *home;
+
+    if (env != NULL)
+    {
+        return snprintf(path, size, "%s", env) < size ? 0 : -1;
+    }
+    home = getenv("HOME");
+    if (home == NULL)
+    {
+        return -1;
+    }
+    return snprintf(path, size, "%s/%s", home, CACHE_FILE) < size ? 0 : -1;
+}
+
+/* Read the entries that did not expire, return their number */
+static int cache_read(struct cache_entry *entries, int max)
+{
+    char path[256], line[256];
+    FILE *fp;
+    int count = 0;
+    time_t now = time(NULL);
+
+    if (cache_path(path, sizeof(path)) != 0 ||
+        (fp = fopen(path, "r")) == NULL)
+    {
+        return 0;
+    }
+    while (count < max && fgets(line, sizeof(line), fp) != NULL)
+    {
+        struct cache_entry *e = &entries[count];
+
+        if (line[0] == '#' ||
+            sscanf(line, "%10s %15s %x %x %ld", e->serial, e->addr,
+                   &e->rf_address, &e->firmware, &e->stamp) != 5)
+        {
+            continue;
+        }
+        if (e->stamp <= now && now - e->stamp < CUBE_CACHE_TTL)
+        {
+            count++;
+        }
+    }
+    fclose(fp);
+
+    return count;
+}
+
+int cache_lookup(const char *serial, struct sockaddr_in *sin)
+{
+    struct cache_entry entries[CACHE_MAX];
+    int count, i;
+
+    count = cache_read(entries, CACHE_MAX);
+    for (i = 0; i < count; i++)
+    {
+        if (strcmp(entries[i].serial, serial) == 0 &&
+            inet_pton(AF_INET, entries[i].addr, &sin->sin_addr) == 1)
+        {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Replace the cache file with 'n' entries */
+static int cache_write(const struct cache_entry *entries, int n)
+{
+    char path[256], tmp[272];
+    FILE *fp;
+    int j;
+
+    if (cache_path(path, sizeof(path)) != 0)
+    {
+        return -1;
+    }
+    /* Replace the file at once, a concurrent reader never sees half of it */
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    if ((fp = fopen(tmp, "w")) == NULL)
+    {
+        return -1;
+    }
+    fprintf(fp, "# serial address rf_address firmware time\n");
+    for (j = 0; j < n; j++)
+    {
+        fprintf(fp, "%s %s %06x %04x %ld\n", entries[j].serial,
+                entries[j].addr, entries[j].rf_address, entries[j].firmware,
+                entries[j].stamp);
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int cache_store(const struct MAX_cube *cubes, int count)
+{
+    struct cache_entry entries[CACHE_MAX];
+    int n, i, j;
+    long now = (long)time(NULL);
+
+    n = cache_read(entries, CACHE_MAX);
+    for (i = 0; i < count; i++)
+    {
+        const struct Discover_Data *D_Data = &cubes[i].D_Data;
+        const struct sockaddr_in *sin =
+            (const struct sockaddr_in*)&cubes[i].addr;
+        struct cache_entry e;
+
+        if (sin->sin_family != AF_INET)
+        {
+            continue;
+        }
+        snprintf(e.serial, sizeof(e.serial), "%.*s",
+                 (int)sizeof(D_Data->Serial_number), D_Data->Serial_number);
+        inet_ntop(AF_INET, &sin->sin_addr, e.addr, sizeof(e.addr));
+        e.rf_address = (D_Data->RF_address[0] << 16) |
+            (D_Data->RF_address[1] << 8) | D_Data->RF_address[2];
+        e.firmware = (D_Data->Firmware_version[0] << 8) |
+            D_Data->Firmware_version[1];
+        e.stamp = now;
+        /* Refresh the entry of a known cube, the oldest one goes if full */
+        for (j = 0; j < n && strcmp(entries[j].serial, e.serial) != 0; j++)
+            ; /* nothing */
+        if (j == CACHE_MAX)
+        {
+            int oldest = 0;
+
+            for (j = 1; j < n; j++)
+            {
+                if (entries[j].stamp < entries[oldest].stamp)
+                {
+                    oldest = j;
+                }
+            }
+            j = oldest;
+        }
+        else if (j == n)
+        {
+            n++;
+        }
+        entries[j] = e;
+    }
+
+    return cache_write(entries, n);
+}
+
+int cache_forget(const char *serial)
+{
+    struct cache_entry entries[CACHE_MAX];
+    int n, i, j;
+
+    n = cache_read(entries, CACHE_MAX);
+    for (i = 0, j = 0; i < n; i++)
+    {
+        if (strcmp(entries[i].serial, serial) != 0)
+        {
+            entries[j++] = entries[i];
+        }
+    }
+    if (j == n)
+    {
+        return 0;
+    }
+
+    return cache_write(entries, j);
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CUBE_CACHE_H
+#define CUBE_CACHE_H
+
+#include <netinet/in.h>
+
+#include "max.h"
+
+/* Discovered cubes are kept in a cache file, $MAXCTL_CACHE or
+ * ~/.maxctl_cubes, so that a cube can be addressed by serial number without
+ * running a discovery each time. Entries expire after CUBE_CACHE_TTL s. */
+#define CUBE_CACHE_TTL 3600
+
+/* cache_lookup fills sin with the address of the cube with serial number
+ * 'serial'. Return zero if a fresh entry was found. */
+int cache_lookup(const char *serial, struct sockaddr_in *sin);
+/* cache_store adds or refreshes 'count' discovered cubes in the cache file.
+ * Return zero on success. */
+int cache_store(const struct MAX_cube *cubes, int count);
+/* cache_forget drops the entry of the cube with serial number 'serial', e.g.
+ * when the cube cannot be reached at its address any more. Return zero on
+ * success. */
+int cache_forget(const char *serial);
+
+#endif /* CUBE_CACHE_H */
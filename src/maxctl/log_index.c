@@ -0,0 +1,491 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_index.h"
+#include "maxlog.h"
+
+#define INDEX_MAGIC "MAXIDX"
+#define INDEX_VERSION 1
+#define INDEX_TEXT 0       /* kind of a text log, else enum MAXLogFormat */
+#define INDEX_BUF 256      /* entries written at once */
+
+struct index_header {
+    char     magic[6];     /* INDEX_MAGIC */
+    uint8_t  version;
+    uint8_t  kind;         /* INDEX_TEXT or enum MAXLogFormat */
+    uint32_t created;      /* creation time in the header of a binary log */
+    uint32_t reserved;
+    uint64_t log_size;     /* bytes of log data indexed */
+};
+
+struct index_entry {
+    uint32_t time;
+    uint32_t reserved;
+    uint64_t offset;       /* of the sample in the log data */
+};
+
+/* Walks the samples of a log of any format */
+struct log_cursor {
+    int kind;
+    const char *text;      /* text log data */
+    size_t size;
+    const MAX_log_map *map;    /* binary log */
+    MAX_log_decoder dec;
+    size_t off;            /* next sample */
+    size_t start, end;     /* current sample */
+    uint32_t time;
+    int restart;           /* decoding can start at the current sample */
+};
+
+/* Return non zero if the line at 'p' is the timestamp of a text sample,
+ * "# YYYY/MM/DD HH:MM:SS" */
+static int text_sample_time(const char *p, const char *end, uint32_t *t)
+{
+    char line[32];
+    size_t len = end - p;
+    struct tm tm;
+
+    if (len < 3 || p[0] != '#' || p[1] != ' ' || p[2] < '0' || p[2] > '9')
+    {
+        return 0;
+    }
+    if (len >= sizeof(line))
+    {
+        len = sizeof(line) - 1;
+    }
+    memcpy(line, p, len);
+    line[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(line, "# %d/%d/%d %d:%d:%d", &tm.tm_year, &tm.tm_mon,
+               &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *t = mktime(&tm);
+
+    return 1;
+}
+
+static const char* next_line(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+
+    return eol != NULL ? eol + 1 : end;
+}
+
+static int next_text_sample(struct log_cursor *c)
+{
+    const char *end = c->text + c->size;
+    const char *p = c->text + c->off;
+
+    /* Skip anything before the timestamp */
+    while (p < end && !text_sample_time(p, end, &c->time))
+    {
+        p = next_line(p, end);
+    }
+    if (p == end)
+    {
+        c->off = c->size;
+        return 0;
+    }
+    c->start = p - c->text;
+    p = next_line(p, end);
+    while (p < end && !(end - p >= 2 && p[0] == '#' && p[1] == ' '))
+    {
+        p = next_line(p, end);
+    }
+    c->end = c->off = p - c->text;
+    c->restart = 1;
+
+    return 1;
+}
+
+static void init_cursor(struct log_cursor *c, size_t offset)
+{
+    c->off = offset;
+    if (c->kind != INDEX_TEXT)
+    {
+        initMAXLogDecoder(&c->dec, c->map, offset);
+    }
+}
+
+/* Move to the next sample, return 1 if there is one, 0 at the end of the
+ * log and negative if the log is corrupted */
+static int next_sample(struct log_cursor *c)
+{
+    int res;
+
+    if (c->kind == INDEX_TEXT)
+    {
+        return next_text_sample(c);
+    }
+    c->start = c->dec.p - c->dec.start;
+    res = nextMAXLogSample(&c->dec);
+    if (res > 0)
+    {
+        c->time = c->dec.time;
+        c->end = c->off = c->dec.p - c->dec.start;
+        c->restart = c->dec.key;
+    }
+    return res;
+}
+
+/* Bring the index of the log up to date. The samples are only walked from
+ * the last index entry, those already indexed are not read again. */
+static int update_index(const char *idx_path, struct log_cursor *c,
+        uint32_t created)
+{
+    struct index_header header;
+    struct index_entry last, buf[INDEX_BUF];
+    struct stat st;
+    size_t count = 0;
+    int fd, used = 0, since = LOG_INDEX_EVERY, first = 0, res;
+
+    fd = open(idx_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        goto error;
+    }
+    if (st.st_size >= sizeof(header) &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == INDEX_VERSION && header.kind == c->kind &&
+        header.created == created && header.log_size <= c->size)
+    {
+        count = (st.st_size - sizeof(header)) / sizeof(last);
+    }
+    /* The last entry must still point to a sample of that time, else the
+     * log was replaced */
+    if (count > 0)
+    {
+        if (pread(fd, &last, sizeof(last),
+                  sizeof(header) + (count - 1) * sizeof(last)) != sizeof(last))
+        {
+            goto error;
+        }
+        init_cursor(c, last.offset);
+        if (next_sample(c) <= 0 || c->time != last.time ||
+            c->start != last.offset)
+        {
+            count = 0;
+        }
+        else if (header.log_size == c->size)
+        {
+            close(fd);
+            return 0;
+        }
+        init_cursor(c, last.offset);
+        first = 1;
+    }
+    if (count == 0)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.kind = c->kind;
+        header.created = created;
+        init_cursor(c, 0);
+    }
+    if (ftruncate(fd, sizeof(header) + count * sizeof(last)) < 0 ||
+        lseek(fd, 0, SEEK_END) < 0)
+    {
+        goto error;
+    }
+
+    while ((res = next_sample(c)) > 0)
+    {
+        if (first)
+        {
+            /* Already indexed */
+            first = 0;
+            since = 1;
+            continue;
+        }
+        if (!c->restart || since < LOG_INDEX_EVERY)
+        {
+            since++;
+            continue;
+        }
+        memset(&buf[used], 0, sizeof(buf[used]));
+        buf[used].time = c->time;
+        buf[used].offset = c->start;
+        since = 1;
+        if (++used == INDEX_BUF)
+        {
+            if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+            {
+                goto error;
+            }
+            used = 0;
+        }
+    }
+    if (used > 0 && write(fd, buf, used * sizeof(buf[0])) !=
+        used * sizeof(buf[0]))
+    {
+        goto error;
+    }
+    /* A partial sample at the end is indexed once it is complete */
+    header.log_size = c->off;
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        goto error;
+    }
+    close(fd);
+
+    return 0;
+
+error:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return -1;
+}
+
+/* Offset of the last indexed sample taken at or before 'from' */
+static size_t seek_index(const char *idx_path, time_t from)
+{
+    const struct index_entry *entry;
+    struct stat st;
+    void *addr;
+    size_t lo, hi, offset = 0;
+    int fd;
+
+    fd = open(idx_path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size <= sizeof(struct index_header))
+    {
+        close(fd);
+        return 0;
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return 0;
+    }
+    entry = (const struct index_entry*)
+        ((const char*)addr + sizeof(struct index_header));
+    lo = 0;
+    hi = (st.st_size - sizeof(struct index_header)) / sizeof(*entry);
+    /* Find the first entry after 'from' */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (entry[mid].time <= from)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo > 0)
+    {
+        offset = entry[lo - 1].offset;
+    }
+    munmap(addr, st.st_size);
+
+    return offset;
+}
+
+static int print_text_sample(FILE *out, const struct log_cursor *c,
+        uint32_t rf_address)
+{
+    const char *p = c->text + c->start, *end = c->text + c->end;
+    const char *first = next_line(p, end);
+    const char *q;
+    int match = (rf_address == 0);
+
+    for (q = first; !match && q < end; q = next_line(q, end))
+    {
+        match = (q[0] != '#' && strtoul(q, NULL, 16) == rf_address);
+    }
+    if (!match)
+    {
+        return 0;
+    }
+    fwrite(p, 1, first - p, out);
+    for (q = first; q < end; )
+    {
+        const char *eol = next_line(q, end);
+
+        if (rf_address == 0 || q[0] == '#' ||
+            strtoul(q, NULL, 16) == rf_address)
+        {
+            fwrite(q, 1, eol - q, out);
+        }
+        q = eol;
+    }
+
+    return 1;
+}
+
+static int print_bin_sample(FILE *out, const struct log_cursor *c,
+        uint32_t rf_address)
+{
+    const MAX_log_decoder *dec = &c->dec;
+    time_t t = dec->time;
+    char buf[64];
+    int i, match = -1;
+
+    if (rf_address != 0)
+    {
+        for (i = 0; i < dec->count && match < 0; i++)
+        {
+            if (dec->state[i].rf_address == rf_address)
+            {
+                match = i;
+            }
+        }
+        if (match < 0)
+        {
+            return 0;
+        }
+    }
+    strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", localtime(&t));
+    fprintf(out, "# %s\n", buf);
+    fputs(MAX_LOG_TEXT_HEADER, out);
+    if (match < 0)
+    {
+        logMAXDeviceStates(out, dec->state, dec->count);
+    }
+    else
+    {
+        logMAXDeviceStates(out, &dec->state[match], 1);
+    }
+
+    return 1;
+}
+
+int query_log(FILE *out, const char *path, time_t from, time_t to,
+        uint32_t rf_address)
+{
+    struct log_cursor *c;
+    MAX_log_map map;
+    char idx_path[512];
+    void *text = NULL;
+    uint32_t created = 0;
+    int count = 0, res;
+
+    if (snprintf(idx_path, sizeof(idx_path), "%s.idx", path) >=
+        sizeof(idx_path))
+    {
+        return -1;
+    }
+    c = malloc(sizeof(*c));
+    if (c == NULL)
+    {
+        return -1;
+    }
+    memset(c, 0, sizeof(*c));
+    if (mapMAXLog(path, &map) == 0)
+    {
+        c->kind = map.header->format;
+        c->map = &map;
+        c->size = map.size;
+        created = map.header->created;
+    }
+    else
+    {
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            free(c);
+            return fd < 0 ? -1 : 0;
+        }
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (text == MAP_FAILED)
+        {
+            free(c);
+            return -1;
+        }
+        c->kind = INDEX_TEXT;
+        c->text = text;
+        c->size = st.st_size;
+    }
+
+    /* Without an index, e.g. in a read only directory, the log is read
+     * from the start */
+    if (update_index(idx_path, c, created) < 0)
+    {
+        init_cursor(c, 0);
+    }
+    else
+    {
+        init_cursor(c, seek_index(idx_path, from));
+    }
+
+    while ((res = next_sample(c)) > 0)
+    {
+        if (c->time < from)
+        {
+            continue;
+        }
+        if (c->time > to)
+        {
+            break;
+        }
+        if (c->kind == INDEX_TEXT)
+        {
+            count += print_text_sample(out, c, rf_address);
+        }
+        else
+        {
+            count += print_bin_sample(out, c, rf_address);
+        }
+    }
+
+    if (text != NULL)
+    {
+        munmap(text, c->size);
+    }
+    else
+    {
+        unmapMAXLog(&map);
+    }
+    free(c);
+
+    return res < 0 ? -1 : count;
+}
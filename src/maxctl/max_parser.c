@@ -206,11 +206,29 @@ int free_ruleset(union cfglist *cl, void *param)
     return 0;
 }
 
+void pack_auto_schedule(struct auto_schedule *as)
+{
+    struct program *program = as->schedule;
+    int i = 0;
+
+    while (program != NULL && i < MAX_CMD_SETPOINTS * 2)
+    {
+        int temp = (int)(program->temperature * 2);
+        int t = (60 * program->hour + program->minutes) / 5;
+
+        as->packed[i] = (temp << 1) | ((t >> 8) & 0x1);
+        as->packed[i + 1] = t & 0xff;
+        i += 2;
+        program = program->next;
+    }
+    as->packed_len = i;
+}
+
 int flag_auto(union cfglist *cl, void *param)
 {
     struct auto_schedule *as;
-    struct program *program;
     MAX_msg_list* msg_list = (MAX_msg_list*)param;
+    unsigned char *msg_program;
 
     if (cl == NULL)
     {
@@ -219,49 +237,16 @@ int flag_auto(union cfglist *cl, void *param)
 
     as = &cl->auto_schedule;
 
-    if (as->day < 0 || as->day >= sizeof(week_days) / sizeof(week_days[0]))
+    if (as->day >= sizeof(week_days) / sizeof(week_days[0]))
     {
         return -1;
     }
-    else
-    {
-        unsigned char *msg_program = findMAXDaySchedule(as->day, msg_list);
-        int s = 0;
-        if (msg_program != NULL)
-        {
-            /* Raise skip flag and clear it if a difference is found */
-            as->skip = 1;
-        }                 
-        program = as->schedule;
-        while (program != NULL)
-        {
-            float fval;
-            uint16_t hours, mins;
-            uint16_t ws;
-            
-            /* Get value from MAX message */
-            fval = (msg_program[s] >> 1) / 2.;
-            ws = (((msg_program[s] & 1) << 8)
-                 | msg_program[s + 1]) * 5;
-            hours = ws / 60;
-            mins = ws %60;
-            /* Compare values and clear skip flag if difference found */
-            if (program->temperature != fval ||
-                program->hour != hours ||
-                program->minutes !=mins)
-            {
-                as->skip = 0;
-                break;
-            }
-            s += 2;
-            program = program->next;
-            /* Break loop if schedule in MAX message reached end of day */
-            if (hours >= 24)
-            {
-                break;
-            }
-        }
-    }
+
+    /* Unchanged if the cube has the same set points, the day is sent when
+     * the device has no weekly program */
+    msg_program = findMAXDaySchedule(as->day, msg_list);
+    as->skip = (msg_program != NULL &&
+                memcmp(as->packed, msg_program, as->packed_len) == 0);
     return 0;
 }
 
@@ -313,6 +298,14 @@ auto_schedule:
         {
             walklist((union cfglist*)as, flag_auto, msg_list);
         }
+        config->changed_days = 0;
+        for (; as != NULL; as = as->next)
+        {
+            if (as->skip == 0)
+            {
+                config->changed_days |= 1 << as->day;
+            }
+        }
         /* Could continue in a while loop if there would be more 'C'
          * messages for the same device
          * msglist = findMAXConfig(rf_address, msglist->next); */
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "maxmsg.h"
+
 #if 0
 #define MAX_PARSER_DEBUG
 #endif
@@ -54,6 +56,10 @@ struct auto_schedule {
     uint16_t day;
     int      skip;
     struct program *schedule;
+    /* schedule packed as in the weekly program of a 'C' message, only the
+     * first packed_len bytes are set */
+    unsigned char packed[MAX_CMD_SETPOINTS * 2];
+    int      packed_len;
 };
 
 struct config {
@@ -61,6 +67,7 @@ struct config {
     float    eco_temp;
     float    comfort_temp;
     int      skip;
+    uint8_t  changed_days; /* bit n set if day n differs from the cube */
     struct auto_schedule *auto_schedule;
 };
 
@@ -98,6 +105,10 @@ int dump_ruleset(union cfglist *cl, void *param);
 /* flag_ruleset flags an entry in the rule set if it is identical to the
  * configuration found in the message list passed as argument. */
 int flag_ruleset(union cfglist *cl, void *param);
+/* pack_auto_schedule packs the program of a day in wire format, the parser
+ * rejects days with more than MAX_CMD_SETPOINTS set points as they could not
+ * be sent in one 's' command */
+void pack_auto_schedule(struct auto_schedule *as);
 /* free_ruleset frees an entry in the rule set. An entry corresponds to a
  * device */
 int free_ruleset(union cfglist *cl, void *param);
@@ -30,12 +30,23 @@
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #include "max.h"
 #include "maxmsg.h"
 #include "base64.h"
+#include "maxcmd.h"
+#include "maxlog.h"
+#include "maxcap.h"
+#include "maxstats.h"
 
 #include "max_parser.h"
+#include "cube_cache.h"
+#include "log_index.h"
+#include "replay.h"
 
 #if 1
 #define MAX_DEBUG
@@ -44,6 +55,24 @@
 #define MAX_CONFIG_FILE "MAX.conf"
 
 #define MSG_TMO 500      /* Message receive timeout */
+#define CMD_TMO 5000     /* 'S' reply timeout */
+#define CONNECT_TMO 5000 /* TCP connection timeout */
+
+#define DISCOVER_TMO 2000 /* Time for cubes to answer a discovery (ms) */
+#define DISCOVER_MAX 16   /* Most cubes reported by a discovery */
+#define SERIAL_LEN sizeof(((struct Discover_Data*)0)->Serial_number)
+
+#define FLEET_WORKERS 4        /* Cubes updated at the same time */
+#define FLEET_WORKERS_MAX 64
+#define FLEET_CUBE_TMO 120000  /* Longest push to one cube (ms) */
+#define FLEET_TIMEOUT (-1)     /* Worker killed after FLEET_CUBE_TMO */
+#define FLEET_NOSTART (-2)     /* Worker could not be started */
+
+#define LOG_BACKOFF_MIN 1     /* First reconnect delay in daemon mode (s) */
+#define LOG_BACKOFF_MAX 300   /* Longest reconnect delay in daemon mode (s) */
+#define LOG_NO_SAMPLE (-1)    /* No 'L' message to log */
+#define LOG_WRITE_ERR (-2)    /* The sample could not be written */
+#define LOG_TOO_MANY (-3)     /* More than MAX_LOG_DEVICES in a binary log */
 
 enum Mode
 {
@@ -63,25 +92,76 @@ static char* week_days[] = {
 };
 
 struct send_param {
-    int connectionId;
+    MAX_cmdq *cmdq;
+    MAX_msg_list *hello; /* Hello packet of the session */
     void *data;
 };
 
+/* Number of 's' commands in flight, see --window */
+static int cmd_window = MAX_CMD_WINDOW;
+
+/* Log file formats, see --format */
+static const struct {
+    const char *name;
+    int format; /* enum MAXLogFormat, 0 for text */
+} log_formats[] = {
+    { "text", 0 },
+    { "bin", MAXLogFixed },
+    { "delta", MAXLogDelta },
+};
+static int log_format = 0;
+
+/* Latency histograms go there at exit, see --stats */
+static FILE *stats_file;
+/* Set by SIGINT or SIGTERM, log returns at the next sample */
+static volatile sig_atomic_t log_stop;
+
+/* Device that gets a new mode */
+struct mode_target {
+    uint32_t rf_address;
+    int room_id;
+    unsigned char temp_mode; /* Temp_and_Mode byte */
+    int queued;
+};
+
 struct mode_param {
     int mode;
     char *device_id;
+    struct mode_target *target;
+    int count;
 };
 
+/* Most thermostats looked up in a room when coalescing mode commands */
+#define MAX_ROOM_DEVICES 64
+
 void help(const char* program)
 {
-    printf("Usage: %s <address of MAX! cube> <port of MAX! cube> <command> " \
-           "<params>\n", program);
-    printf("       %s discover\n", program);
+    printf("Usage: %s [options] <address or serial of MAX! cube> " \
+           "<port of MAX! cube> <command> <params>\n", program);
+    printf("       %s discover [count|serial]\n", program);
+    printf("       %s [options] fleet <fleet_file> [workers]\n", program);
+    printf("       %s convert <binary_log> [text_log]\n", program);
+    printf("       %s query <log> <from> <to> [device_id]\n", program);
+    printf("       %s replay <capture_file> [fast|timed|parse] [config_file]\n",
+           program);
+    printf("\tOptions\n" \
+           "\t-w, --window <n>  's' commands in flight, 1 to %d (default %d)\n"
+           "\t-f, --format <f>  log format: text, bin or delta (default text), bin\n"
+           "\t                  and delta hold at most 256 devices a sample\n"
+           "\t-c, --capture <f> append the traffic with the cube to capture "
+           "file f\n"
+           "\t--stats[=<f>]     write latency histograms as JSON to file f "
+           "(default stderr)\n"
+           "\t                  at exit, log exits on SIGINT or SIGTERM\n",
+           MAX_CMD_WINDOW_MAX, MAX_CMD_WINDOW);
     printf("\tCommands  Params\n" \
            "\tget       status\n" \
            "\tset       mode <auto|comfort|eco> all|<device_id> [config_file]\n" \
            "\tset       program all|<device_id> [config_file]\n" \
-           "\tlog       <logfile> <freq(mins)>\n");
+           "\tlog       <logfile> <freq(mins)> [daemon]\n");
+    printf("\tfleet_file lines: <address> <port> [config_file], the program "
+           "of all devices\n\tis set on every cube, %d workers by default\n",
+           FLEET_WORKERS);
 }
 
 MAX_msg_list* create_quit_pkt(int connectionId)
@@ -99,12 +179,27 @@ MAX_msg_list* create_quit_pkt(int connectionId)
     return appendMAXmsg(NULL, m_q, len);
 }
 
+MAX_msg_list* create_list_pkt(int connectionId)
+{
+    struct MAX_message *m_l;
+    struct l_Data *l_d;
+    size_t len;
+    
+    len = sizeof(struct MAX_message) - 1 + sizeof(struct l_Data);
+    m_l = malloc(len);
+    m_l->type = 'l';
+    m_l->colon = ':';
+    l_d = (struct l_Data*)m_l->data;
+    memcpy(l_d, MSG_END, MSG_END_LEN);
+    return appendMAXmsg(NULL, m_l, len);
+}
+
 int eval_S_response(MAX_msg_list* msg_list)
 {
     struct S_Data *S_D;
     while (msg_list != NULL) {
         S_D = (struct S_Data*)msg_list->MAX_msg->data;
-        if (S_D->Command_Result[0] != '0')
+        if (msg_list->MAX_msg->type == 'S' && S_D->Command_Result[0] != '0')
         {
             return -1;
         }
@@ -114,17 +209,105 @@ int eval_S_response(MAX_msg_list* msg_list)
     return 0;
 }
 
+/* Size of the largest 's' command payload */
+#define MAX_S_CMD_SZ sizeof(struct s_Program_Data)
+
+/* Report the 'S' reply of a command sent through the command queue */
+void s_cmd_done(void *arg, MAX_msg_list *cmd, MAX_msg_list *reply, int retry)
+{
+#ifdef MAX_DEBUG
+    dumpMAXHostpkt(reply);
+#endif
+    if (retry)
+    {
+        printf("Warning : 'S' command discarded, will be sent again\n");
+    }
+    else if (eval_S_response(reply) != 0)
+    {
+        printf("Error : 'S' command discarded\n");
+    }
+}
+
+/* Queue an 's' command with 'data' as payload. The message is built on the
+ * stack, nothing is allocated on the send path. */
+int send_s_cmd(MAX_cmdq *cmdq, const void *data, size_t data_sz)
+{
+    char buf[sizeof(struct MAX_message) - 1 +
+             BASE64_ENCODED_SZ(MAX_S_CMD_SZ) + MSG_END_LEN];
+    struct MAX_message *m_s = (struct MAX_message*)buf;
+    MAX_msg_list msg;
+    int off, outlen;
+
+    /* Create packet */
+    off = sizeof(struct MAX_message) - 1;
+    outlen = hex_to_base64_buf((const unsigned char*)data, data_sz,
+                               m_s->data, sizeof(buf) - off - MSG_END_LEN);
+    if (outlen < 0)
+    {
+        return -1;
+    }
+    m_s->type = 's';
+    m_s->colon = ':';
+    memcpy(&m_s->data[outlen], MSG_END, MSG_END_LEN);
+    linkMAXmsg(NULL, &msg, m_s, off + outlen + MSG_END_LEN);
+#ifdef MAX_DEBUG
+    dumpMAXNetpkt(&msg);
+#endif
+    /* Queue message, replies are reported by s_cmd_done */
+    if (submitMAXCmd(cmdq, &msg) < 0)
+    {
+        printf("Error : cannot queue 's' command\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Queue the commands built by 'send' for every rule and by 'finish' once all
+ * the rules are walked, then send them within
+ * the radio budget reported by the cube, starting with the Hello packet
+ * 'hello'. Return negative if the commands could not be sent. */
+int send_cmds(int connectionId, MAX_msg_list *hello, struct ruleset *rs,
+    int (*send)(union cfglist*, void*), int (*finish)(struct send_param*),
+    void *data)
+{
+    struct send_param send_param;
+    long est;
+    int res;
+
+    send_param.cmdq = createMAXCmdQueue(connectionId, cmd_window, CMD_TMO);
+    send_param.hello = hello;
+    send_param.data = data;
+    if (send_param.cmdq == NULL)
+    {
+        printf("Error : cannot create command queue\n");
+        return -1;
+    }
+    setMAXCmdCallback(send_param.cmdq, s_cmd_done, NULL);
+    updateMAXCmdQueue(send_param.cmdq, hello);
+
+    walklist((union cfglist*)rs, send, &send_param);
+    if (finish != NULL)
+    {
+        finish(&send_param);
+    }
+
+    est = estimateMAXCmdQueue(send_param.cmdq);
+    printf("Duty cycle %d%%, estimated completion in %ld s\n",
+           dutyMAXCmdQueue(send_param.cmdq), (est + 999) / 1000);
+    res = flushMAXCmdQueue(send_param.cmdq);
+    if (res < 0)
+    {
+        printf("Error : 'S' response not received from MAX!cube\n");
+    }
+    freeMAXCmdQueue(send_param.cmdq);
+    return res;
+}
+
 /* param -  pointer to struct s_Program_Data */
 int send_auto_schedule(union cfglist *cl, void *param)
 {
     struct auto_schedule *as;
-    struct program *program;
-    int temp, hour, minutes, t;
-    int i, off, res;
-    size_t outlen;
-    struct MAX_message *m_s;
-    MAX_msg_list *msg_list = NULL;
-    int connectionId = ((struct send_param*)param)->connectionId;
+    MAX_cmdq *cmdq = ((struct send_param*)param)->cmdq;
     struct s_Program_Data *s_Program_Data =
         (struct s_Program_Data*)((struct send_param*)param)->data;
 
@@ -146,94 +329,33 @@ int send_auto_schedule(union cfglist *cl, void *param)
         return -1;
     }
 
-    s_Program_Data->Day_of_week[0] = as->day;
-#ifdef MAX_DEBUG
-    printf("    packing schedule\n");
-#endif
-    program = as->schedule;
-    if (program == NULL)
+    if (as->packed_len == 0)
     {
 #ifdef MAX_DEBUG
         printf("    empty schedule, send nothing\n");
 #endif
         return 0;
     }
-    /* Pack the daily program here */
-    i = 0;
-    while (program != NULL)
-    {
-        temp = (int)(program->temperature * 2);
-        hour = program->hour;
-        minutes = program->minutes;
-        t = (60 * hour + minutes) / 5;
-        /* Use first fiels Temp_and_Time to write into next as well */
-        s_Program_Data->Temp_and_Time[i] = ((temp << 1) | ((t >> 8) & (0x1)));
-        s_Program_Data->Temp_and_Time[i + 1] = (t & 0xff);
-        i += 2;
-        program = program->next;
-        if (i >= (MAX_CMD_SETPOINTS * 2))
-        {
-            break;
-        }
-    }
-
-    /* Create packet */
-    off = sizeof(struct MAX_message) - 1;
-    m_s = (struct MAX_message*)hex_to_base64(
-           (const unsigned char*)s_Program_Data,
-           sizeof(*s_Program_Data), off, MSG_END_LEN, &outlen);
-    m_s->type = 's';
-    m_s->colon = ':';
-    memcpy(&m_s->data[outlen], MSG_END, MSG_END_LEN);
-    msg_list = appendMAXmsg(NULL, m_s, off + outlen + MSG_END_LEN);
-#ifdef MAX_DEBUG
-    dumpMAXNetpkt(msg_list);
-#endif
-    /* Send message */
-    res = MAXMsgSend(connectionId, msg_list);
-    freeMAXpkt(&msg_list);
-    if (res != 0)
-    {
-        return res;
-    }
+    /* The daily program was packed when the rule set was loaded, clear the
+     * tail so that no set point of the previous day is sent */
+    s_Program_Data->Day_of_week[0] = as->day;
+    memcpy(s_Program_Data->Temp_and_Time, as->packed, as->packed_len);
+    memset(s_Program_Data->Temp_and_Time + as->packed_len, 0,
+           sizeof(s_Program_Data->Temp_and_Time) - as->packed_len);
 
-    /* Wait for S response */
-    if (MaxMsgRecv(connectionId, &msg_list) < 0)
-    {
-        return 0;
-    }
-#ifdef MAX_DEBUG
-    dumpMAXHostpkt(msg_list);
-#endif
-    res = eval_S_response(msg_list);
-    freeMAXpkt(&msg_list);
-    if (res != 0)
-    {
-        printf("Error : 'S' command discarded\n");
-        /* Don't return here, call close session gracefully */
-    }
-    
-    return res;
+    return send_s_cmd(cmdq, s_Program_Data, sizeof(*s_Program_Data));
 }
 
+/* Collect the devices that get the new mode, commands are queued by
+ * send_mode_targets */
 int send_mode(union cfglist *cl, void *param)
 {
-    struct s_Temp_Mode_Data s_Temp_Mode_Data;
     struct send_param *send_param = (struct send_param*)param;
     struct mode_param *mode_param = (struct mode_param*)send_param->data;
+    struct mode_target *target;
     uint32_t rf_address;
     struct config *config;
-    int off, res;
-    size_t outlen;
-    struct MAX_message *m_s;
-    MAX_msg_list *msg_list = NULL;
-    int connectionId = ((struct send_param*)param)->connectionId;
-
-    /* Send Temp and Mode */
-    /* Initialize base string */
-    memset(&s_Temp_Mode_Data, 0, sizeof(s_Temp_Mode_Data));
-    memcpy(s_Temp_Mode_Data.Base_String,
-           base_string_code(TemperatureAndMode), BS_CODE_SZ);
+    unsigned char temp_mode;
 
     if (cl == NULL || cl->ruleset.device_config == NULL)
     {
@@ -255,29 +377,20 @@ int send_mode(union cfglist *cl, void *param)
     printf("device: %x, send_mode mode: %d, device_id: %s\n", rf_address,
         mode_param->mode, mode_param->device_id);
 
-    s_Temp_Mode_Data.RF_Address[0] =
-        (cl->ruleset.device_config->rf_address >> 16) & 0xff;
-    s_Temp_Mode_Data.RF_Address[1] =
-        (cl->ruleset.device_config->rf_address >> 8) & 0xff;
-    s_Temp_Mode_Data.RF_Address[2] =
-        cl->ruleset.device_config->rf_address & 0xff;
-
-    s_Temp_Mode_Data.Room_Nr[0] = config->room_id;
-    
     switch (mode_param->mode)
     {
         case AutoMode:
-            s_Temp_Mode_Data.Temp_and_Mode[0] =
+            temp_mode =
                 (0b11000000 & (AutoTempMode << 6)) | 
                 (0b00111111 & 0);
             break;
         case EcoMode:
-            s_Temp_Mode_Data.Temp_and_Mode[0] =
+            temp_mode =
                 (0b11000000 & (ManualTempMode << 6)) | 
                 (0b00111111 & (int)(config->eco_temp * 2));
             break;
         case ComfortMode:
-            s_Temp_Mode_Data.Temp_and_Mode[0] =
+            temp_mode =
                 (0b11000000 & (ManualTempMode << 6)) | 
                 (0b00111111 & (int)(config->comfort_temp * 2));
             break;
@@ -285,38 +398,108 @@ int send_mode(union cfglist *cl, void *param)
             return 1;
     }
 
-    /* Create packet */
-    off = sizeof(struct MAX_message) - 1;
-    m_s = (struct MAX_message*)hex_to_base64(
-           (const unsigned char*)&s_Temp_Mode_Data,
-           sizeof(s_Temp_Mode_Data), off, MSG_END_LEN, &outlen);
-    m_s->type = 's';
-    m_s->colon = ':';
-    memcpy(&m_s->data[outlen], MSG_END, MSG_END_LEN);
-    msg_list = appendMAXmsg(NULL, m_s, off + outlen + MSG_END_LEN);
-#ifdef MAX_DEBUG
-    dumpMAXNetpkt(msg_list);
-#endif
-    /* Send message */
-    res = MAXMsgSend(connectionId, msg_list);
-    freeMAXpkt(&msg_list);
-
-    /* Wait for S response */
-    if (MaxMsgRecv(connectionId, &msg_list) < 0)
+    target = realloc(mode_param->target,
+                     (mode_param->count + 1) * sizeof(*target));
+    if (target == NULL)
     {
-        return 0;
+        return -1;
     }
-#ifdef MAX_DEBUG
-    dumpMAXHostpkt(msg_list);
-#endif
-    res = eval_S_response(msg_list);
-    freeMAXpkt(&msg_list);
-    if (res != 0)
+    mode_param->target = target;
+    target = &target[mode_param->count++];
+    target->rf_address = rf_address;
+    target->room_id = config->room_id;
+    target->temp_mode = temp_mode;
+    target->queued = 0;
+    return 0;
+}
+
+/* Queue one 'temperature and mode' command, for the device only or, with
+ * BS_FLAG_GROUP in 'flags', for all the devices of the room */
+int send_temp_mode(MAX_cmdq *cmdq, struct mode_target *target, int flags)
+{
+    struct s_Temp_Mode_Data s_Temp_Mode_Data;
+
+    /* Send Temp and Mode */
+    /* Initialize base string */
+    memset(&s_Temp_Mode_Data, 0, sizeof(s_Temp_Mode_Data));
+    memcpy(s_Temp_Mode_Data.Base_String,
+           base_string_code(TemperatureAndMode), BS_CODE_SZ);
+    s_Temp_Mode_Data.Base_String[BS_FLAGS] = flags;
+
+    s_Temp_Mode_Data.RF_Address[0] = (target->rf_address >> 16) & 0xff;
+    s_Temp_Mode_Data.RF_Address[1] = (target->rf_address >> 8) & 0xff;
+    s_Temp_Mode_Data.RF_Address[2] = target->rf_address & 0xff;
+
+    s_Temp_Mode_Data.Room_Nr[0] = target->room_id;
+    s_Temp_Mode_Data.Temp_and_Mode[0] = target->temp_mode;
+
+    return send_s_cmd(cmdq, &s_Temp_Mode_Data, sizeof(s_Temp_Mode_Data));
+}
+
+/* Queue the mode commands. When every thermostat the cube has in a room gets
+ * the same mode, one command is sent for the whole room. */
+int send_mode_targets(struct send_param *send_param)
+{
+    struct mode_param *mode_param = (struct mode_param*)send_param->data;
+    struct mode_target *target = mode_param->target;
+    uint32_t room[MAX_ROOM_DEVICES];
+    int i, j, k, n;
+
+    for (i = 0; i < mode_param->count; i++)
     {
-        printf("Error : 'S' command discarded\n");
-        /* Don't return here, call close session gracefully */
+        int group = 0;
+
+        if (target[i].queued)
+        {
+            continue;
+        }
+        n = findMAXRoomDevices(target[i].room_id, send_param->hello, room,
+                               MAX_ROOM_DEVICES);
+        if (n > 1 && n <= MAX_ROOM_DEVICES)
+        {
+            /* Each device of the room must be a target with the same mode */
+            for (k = 0; k < n; k++)
+            {
+                for (j = i; j < mode_param->count; j++)
+                {
+                    if (target[j].rf_address == room[k] &&
+                        target[j].room_id == target[i].room_id &&
+                        target[j].temp_mode == target[i].temp_mode &&
+                        !target[j].queued)
+                    {
+                        break;
+                    }
+                }
+                if (j == mode_param->count)
+                {
+                    break;
+                }
+            }
+            group = (k == n);
+        }
+        if (group)
+        {
+            printf("room: %d, send_mode to %d devices\n", target[i].room_id,
+                   n);
+            for (k = 0; k < n; k++)
+            {
+                for (j = i; j < mode_param->count; j++)
+                {
+                    if (target[j].rf_address == room[k])
+                    {
+                        target[j].queued = 1;
+                    }
+                }
+            }
+        }
+        target[i].queued = 1;
+        if (send_temp_mode(send_param->cmdq, &target[i],
+                           group ? BS_FLAG_GROUP : 0) < 0)
+        {
+            return -1;
+        }
     }
-    return res;
+    return 0;
 }
 
 int send_ruleset(union cfglist *cl, void *param)
@@ -327,11 +510,7 @@ int send_ruleset(union cfglist *cl, void *param)
     struct s_Program_Data s_Program_Data;
     struct s_Eco_Temp_Data s_Eco_Temp_Data;
     struct send_param *send_param = param, sched_param;
-    int off, res;
-    size_t outlen;
-    struct MAX_message *m_s;
-    MAX_msg_list *msg_list = NULL;
-    int connectionId = send_param->connectionId;
+    int res = 0;
 
     /* Send Program / weekly schedule */
     /* Initialize base string */
@@ -383,8 +562,23 @@ int send_ruleset(union cfglist *cl, void *param)
 #endif
     }
     
+    if (config->changed_days != 0)
+    {
+        int day;
+
+        printf("device %06x: program changed on", rf_address);
+        for (day = 0; day < sizeof(week_days) / sizeof(week_days[0]); day++)
+        {
+            if (config->changed_days & (1 << day))
+            {
+                printf(" %s", week_days[day]);
+            }
+        }
+        printf("\n");
+    }
+
     /* Join data to send params */
-    sched_param.connectionId = send_param->connectionId;
+    sched_param.cmdq = send_param->cmdq;
     sched_param.data = (void*)&s_Program_Data;
     walklist((union cfglist*)as, send_auto_schedule, &sched_param);
 
@@ -425,37 +619,8 @@ int send_ruleset(union cfglist *cl, void *param)
     s_Eco_Temp_Data.Temperature_Window_Open[0] = (unsigned char)(TEMP_WINDOW_OPEN * 2);
     s_Eco_Temp_Data.Duration_Window_Open[0] = (unsigned char)(DUR_WINDOW_OPEN / 5);
 
-    /* Create packet */
-    off = sizeof(struct MAX_message) - 1;
-    m_s = (struct MAX_message*)hex_to_base64(
-           (const unsigned char*)&s_Eco_Temp_Data,
-           sizeof(s_Eco_Temp_Data), off, MSG_END_LEN, &outlen);
-    m_s->type = 's';
-    m_s->colon = ':';
-    memcpy(&m_s->data[outlen], MSG_END, MSG_END_LEN);
-    msg_list = appendMAXmsg(NULL, m_s, off + outlen + MSG_END_LEN);
-#ifdef MAX_DEBUG
-    dumpMAXNetpkt(msg_list);
-#endif
-    /* Send message */
-    res = MAXMsgSend(connectionId, msg_list);
-    freeMAXpkt(&msg_list);
-
-    /* Wait for S response */
-    if (MaxMsgRecv(connectionId, &msg_list) < 0)
-    {
-        return 0;
-    }
-#ifdef MAX_DEBUG
-    dumpMAXHostpkt(msg_list);
-#endif
-    res = eval_S_response(msg_list);
-    freeMAXpkt(&msg_list);
-    if (res != 0)
-    {
-        printf("Error : 'S' command discarded\n");
-        /* Don't return here, call close session gracefully */
-    }
+    res = send_s_cmd(send_param->cmdq, &s_Eco_Temp_Data,
+                     sizeof(s_Eco_Temp_Data));
 skip_config:
     return res;
 }
@@ -463,13 +628,50 @@ skip_config:
 int read_config(struct ruleset **ruleset, const char *conf)
 {
     FILE *fp = fopen(conf, "r");
-    int res = parse_file(fp, ruleset);
+    int res;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    res = parse_file(fp, ruleset);
 
     fclose(fp);
 
     return res;
 }
 
+/* Serial number of the cube if resolve_cube took its address from the
+ * cache, empty otherwise */
+static char cached_serial[SERIAL_LEN + 1];
+
+static int resolve_serial(const char *serial, struct sockaddr_in *serv_addr);
+
+/* Connect to the cube at serv_addr. A cached address may be stale, e.g. after
+ * the cube got a new one by DHCP: the entry is then dropped and the cube
+ * discovered again before giving up. */
+static int connect_cube(struct sockaddr_in *serv_addr)
+{
+    char addr[INET_ADDRSTRLEN];
+    int connectionId;
+
+    connectionId = MAXConnectTmo((struct sockaddr*)serv_addr, CONNECT_TMO);
+    if (connectionId >= 0 || cached_serial[0] == '\0')
+    {
+        return connectionId;
+    }
+    cache_forget(cached_serial);
+    if (resolve_serial(cached_serial, serv_addr) != 0)
+    {
+        return -1;
+    }
+    if (inet_ntop(AF_INET, &serv_addr->sin_addr, addr, sizeof(addr)) != NULL)
+    {
+        printf("Using IP addr: %s\n", addr);
+    }
+    return MAXConnectTmo((struct sockaddr*)serv_addr, CONNECT_TMO);
+}
+
 int get_status(const char* program, struct sockaddr_in* serv_addr,
         int argc, char *argv[])
 {
@@ -484,14 +686,14 @@ int get_status(const char* program, struct sockaddr_in* serv_addr,
 
     /* Open connection and send configuration */
     /* Connect to cube */
-    if ((connectionId = MAXConnect((struct sockaddr*)serv_addr)) < 0)
+    if ((connectionId = connect_cube(serv_addr)) < 0)
     {
         printf("Error : Could not connect to MAX!cube\n");
         return 1;
     }
 
     /* Wait for Hello message */
-    if (MaxMsgRecvTmo(connectionId, &msg_list, MSG_TMO) < 0)
+    if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0)
     {
         printf("Error : Hello message not received from MAX!cube\n");
         return 1;
@@ -538,97 +740,493 @@ int get(const char* program, struct sockaddr_in* serv_addr,
     return 1;
 }
 
-int logdata(const char* program, struct sockaddr_in* serv_addr,
-        int argc, char *argv[])
-{
-    char *filename, *endptr;
-    int period;
+/* Log file, text or binary as chosen with --format */
+struct log_output {
     FILE *fp;
+    MAX_log_writer *bin;
+};
+
+/* Write a timestamped sample with the last device list in msg_list. Return
+ * LOG_NO_SAMPLE if msg_list has no 'L' message, LOG_TOO_MANY if a binary log
+ * cannot hold that many devices and LOG_WRITE_ERR if the log cannot be
+ * written. */
+static int logsample(struct log_output *out, MAX_msg_list *msg_list)
+{
+    MAX_msg_list *l_msg = NULL;
+    time_t timer;
+    char buf[64];
+    struct tm* tm_info;
 
-    if (argc != 3)
+    while (msg_list != NULL)
     {
-        help(program);
-        return 1;
+        if (msg_list->MAX_msg->type == 'L')
+        {
+            l_msg = msg_list;
+        }
+        msg_list = msg_list->next;
     }
-
-    filename = argv[1];
-    period = strtoul(argv[2], &endptr, 10);
-
-    if (*endptr != '\0')
+    if (l_msg == NULL)
     {
-        printf("Error : bad logging interval\n");
-        return 1;
+        return LOG_NO_SAMPLE;
     }
 
-    fp = fopen(filename, "a+");
-    
-    while(1)
+    time(&timer);
+    if (out->bin != NULL)
     {
-        MAX_msg_list* msg_list = NULL;
-        int connectionId;
-        time_t timer;
-        char buf[64];
-        struct tm* tm_info;
- 
-        /* Open connection and send configuration */
-        /* Connect to cube */
-        if ((connectionId = MAXConnect((struct sockaddr*)serv_addr)) < 0)
-        {
-            printf("Error : Could not connect to MAX!cube\n");
-            goto loop;
-        }
+        struct MAX_device_state *state;
+        int count = decodeMAXDeviceList(l_msg, NULL, 0);
+        int res;
 
-        /* Wait for Hello message */
-        if (MaxMsgRecvTmo(connectionId, &msg_list, MSG_TMO) < 0)
+        if (count < 0)
         {
-            printf("Error : Hello message not received from MAX!cube\n");
-            goto loop;
+            return LOG_NO_SAMPLE;
         }
-
-        time(&timer);
-        tm_info = localtime(&timer);
-
-        strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", tm_info);
-        fprintf(fp, "# %s\n", buf);
-        logMAXHostDeviceList(fp, msg_list);
-        fflush(fp);
-        freeMAXpkt(&msg_list);
-
-        /* Send 'q' (quit) command*/
-        msg_list = create_quit_pkt(connectionId);
-        /* Wait for Hello message */
-        if (MAXMsgSend(connectionId, msg_list) < 0)
+        if (count > MAX_LOG_DEVICES)
         {
-            printf("Error : Hello message not received from MAX!cube\n");
-            /* Don't return here, call MAXDisconnect */
+            return LOG_TOO_MANY;
         }
-        freeMAXpkt(&msg_list);
-
-        if (MAXDisconnect(connectionId) < 0)
+        if ((state = malloc((count + 1) * sizeof(*state))) == NULL)
         {
-            printf("Error : Failed to close connection with MAX!cube\n");
+            return LOG_WRITE_ERR;
         }
-loop:
-        sleep(60 * period);
+        count = decodeMAXDeviceList(l_msg, state, count);
+        res = appendMAXLog(out->bin, timer, state, count);
+        free(state);
+        return (res < 0) ? LOG_WRITE_ERR : 0;
     }
 
+    tm_info = localtime(&timer);
+
+    strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", tm_info);
+    fprintf(out->fp, "# %s\n", buf);
+    logMAXHostDeviceList(out->fp, l_msg);
+    fflush(out->fp);
     return 0;
 }
 
-int set_program(const char* program, struct sockaddr_in* serv_addr,
-        int argc, char *argv[])
+static void stop_log(int sig)
 {
-    struct ruleset *rs;
-    int connectionId;
-    MAX_msg_list* msg_list = NULL;
-    struct send_param send_param;
-    int result = 0;
-    const char *conf = MAX_CONFIG_FILE;
+    log_stop = 1;
+}
 
-    if (argc < 2 || argc > 3)
+static void close_log(struct log_output *out)
+{
+    if (out->bin != NULL)
     {
-        help(program);
-        return 1;
+        closeMAXLog(out->bin);
+    }
+    else
+    {
+        fclose(out->fp);
+    }
+}
+
+/* Log over one long lived session. The device list is refreshed with an 'l'
+ * request every period, the cube is only reconnected when the link drops. */
+static int logdaemon(struct log_output *out, struct sockaddr_in* serv_addr,
+        int period)
+{
+    int connectionId = -1;
+    int backoff = LOG_BACKOFF_MIN;
+
+    while (!log_stop)
+    {
+        MAX_msg_list* msg_list = NULL;
+        int res;
+
+        if (connectionId < 0)
+        {
+            /* Connect to cube, the Hello burst provides the first sample */
+            if ((connectionId = connect_cube(serv_addr)) < 0)
+            {
+                printf("Error : Could not connect to MAX!cube\n");
+                goto retry;
+            }
+            MAXKeepAlive(connectionId, 60);
+            if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0 ||
+                (res = logsample(out, msg_list)) == LOG_NO_SAMPLE)
+            {
+                printf("Error : Hello message not received from MAX!cube\n");
+                goto drop;
+            }
+        }
+        else
+        {
+            /* Send 'l' (device list) command */
+            msg_list = create_list_pkt(connectionId);
+            if (MAXMsgSend(connectionId, msg_list) < 0)
+            {
+                printf("Error : Failed to send device list request\n");
+                goto drop;
+            }
+            freeMAXpkt(&msg_list);
+            if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0 ||
+                (res = logsample(out, msg_list)) == LOG_NO_SAMPLE)
+            {
+                printf("Error : Device list not received from MAX!cube\n");
+                goto drop;
+            }
+        }
+        if (res == LOG_TOO_MANY)
+        {
+            /* Every sample would fail the same way */
+            printf("Error : more than %d devices, use the text log format\n",
+                   MAX_LOG_DEVICES);
+            freeMAXpkt(&msg_list);
+            MAXDisconnect(connectionId);
+            return 1;
+        }
+        if (res == LOG_WRITE_ERR)
+        {
+            /* The link is fine, try again with the next sample */
+            printf("Error : cannot write log\n");
+        }
+        freeMAXpkt(&msg_list);
+        backoff = LOG_BACKOFF_MIN;
+        if (!log_stop)
+        {
+            sleep(60 * period);
+        }
+        continue;
+
+drop:
+        freeMAXpkt(&msg_list);
+        MAXDisconnect(connectionId);
+        connectionId = -1;
+retry:
+        if (!log_stop)
+        {
+            sleep(backoff);
+        }
+        backoff *= 2;
+        if (backoff > LOG_BACKOFF_MAX)
+        {
+            backoff = LOG_BACKOFF_MAX;
+        }
+    }
+    if (connectionId >= 0)
+    {
+        MAXDisconnect(connectionId);
+    }
+
+    return 0;
+}
+
+int logdata(const char* program, struct sockaddr_in* serv_addr,
+        int argc, char *argv[])
+{
+    char *filename, *endptr;
+    int period, res;
+    struct log_output out = { NULL, NULL };
+    struct sigaction sa;
+
+    if (argc < 3 || argc > 4 ||
+        (argc == 4 && strcmp(argv[3], "daemon") != 0))
+    {
+        help(program);
+        return 1;
+    }
+
+    filename = argv[1];
+    period = strtoul(argv[2], &endptr, 10);
+
+    if (*endptr != '\0')
+    {
+        printf("Error : bad logging interval\n");
+        return 1;
+    }
+
+    if (log_format != 0)
+    {
+        out.bin = openMAXLog(filename, log_format);
+    }
+    else
+    {
+        out.fp = fopen(filename, "a+");
+    }
+    if (out.fp == NULL && out.bin == NULL)
+    {
+        printf("Error : cannot open %s\n", filename);
+        return 1;
+    }
+
+    /* Stop between samples so that the log is closed and --stats printed.
+     * No SA_RESTART, the signal cuts the sleep short. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_log;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (argc == 4)
+    {
+        res = logdaemon(&out, serv_addr, period);
+        close_log(&out);
+        return res;
+    }
+    
+    while (!log_stop)
+    {
+        MAX_msg_list* msg_list = NULL;
+        int connectionId;
+ 
+        /* Open connection and send configuration */
+        /* Connect to cube */
+        if ((connectionId = connect_cube(serv_addr)) < 0)
+        {
+            printf("Error : Could not connect to MAX!cube\n");
+            goto loop;
+        }
+
+        /* Wait for Hello message */
+        if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0 ||
+            (res = logsample(&out, msg_list)) == LOG_NO_SAMPLE)
+        {
+            printf("Error : Hello message not received from MAX!cube\n");
+            goto drop;
+        }
+        if (res == LOG_TOO_MANY)
+        {
+            printf("Error : more than %d devices, use the text log format\n",
+                   MAX_LOG_DEVICES);
+            freeMAXpkt(&msg_list);
+            MAXDisconnect(connectionId);
+            close_log(&out);
+            return 1;
+        }
+        if (res == LOG_WRITE_ERR)
+        {
+            printf("Error : cannot write log\n");
+        }
+        freeMAXpkt(&msg_list);
+
+        /* Send 'q' (quit) command*/
+        msg_list = create_quit_pkt(connectionId);
+        /* Wait for Hello message */
+        if (MAXMsgSend(connectionId, msg_list) < 0)
+        {
+            printf("Error : Hello message not received from MAX!cube\n");
+            /* Don't return here, call MAXDisconnect */
+        }
+        freeMAXpkt(&msg_list);
+
+        if (MAXDisconnect(connectionId) < 0)
+        {
+            printf("Error : Failed to close connection with MAX!cube\n");
+        }
+        goto loop;
+
+drop:
+        freeMAXpkt(&msg_list);
+        MAXDisconnect(connectionId);
+loop:
+        if (!log_stop)
+        {
+            sleep(60 * period);
+        }
+    }
+    close_log(&out);
+
+    return 0;
+}
+
+/* Write a binary log in text format */
+int convert(const char* program, int argc, char *argv[])
+{
+    MAX_log_map map;
+    FILE *fp = stdout;
+    int res;
+
+    if (argc < 2 || argc > 3)
+    {
+        help(program);
+        return 1;
+    }
+    if (mapMAXLog(argv[1], &map) < 0)
+    {
+        printf("Error : %s is not a binary log\n", argv[1]);
+        return 1;
+    }
+    if (argc == 3 && (fp = fopen(argv[2], "w")) == NULL)
+    {
+        printf("Error : cannot open %s\n", argv[2]);
+        unmapMAXLog(&map);
+        return 1;
+    }
+    res = dumpMAXLogText(fp, &map);
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+    unmapMAXLog(&map);
+    if (res < 0)
+    {
+        printf("Error : %s is corrupted\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Parse a time given as YYYY/MM/DD[-HH:MM[:SS]] in local time or as @seconds
+ * since the epoch. A day without time starts at 00:00:00, or ends at
+ * 23:59:59 if 'end' is set. */
+static int parse_time(const char *s, int end, time_t *t)
+{
+    struct tm tm;
+    char *endptr;
+    int n = 0, fields;
+
+    if (s[0] == '@')
+    {
+        *t = strtol(s + 1, &endptr, 10);
+        return (*endptr == '\0' && endptr != s + 1) ? 0 : -1;
+    }
+    memset(&tm, 0, sizeof(tm));
+    fields = sscanf(s, "%d/%d/%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n);
+    if (fields != 3)
+    {
+        return -1;
+    }
+    if (s[n] == '-' || s[n] == ' ')
+    {
+        int m = 0;
+
+        fields = sscanf(s + n + 1, "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min,
+                        &m, &tm.tm_sec, &m);
+        if (fields < 2 || s[n + 1 + m] != '\0')
+        {
+            return -1;
+        }
+    }
+    else if (s[n] == '\0')
+    {
+        if (end)
+        {
+            tm.tm_hour = 23;
+            tm.tm_min = 59;
+            tm.tm_sec = 59;
+        }
+    }
+    else
+    {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *t = mktime(&tm);
+
+    return *t == (time_t)-1 ? -1 : 0;
+}
+
+/* Print the samples of a log taken in a time range */
+int query(const char* program, int argc, char *argv[])
+{
+    time_t from, to;
+    uint32_t rf_address = 0;
+    char *endptr;
+    int res;
+
+    if (argc < 4 || argc > 5)
+    {
+        help(program);
+        return 1;
+    }
+    if (parse_time(argv[2], 0, &from) < 0 || parse_time(argv[3], 1, &to) < 0)
+    {
+        printf("Error : bad time, use YYYY/MM/DD[-HH:MM[:SS]] or @seconds\n");
+        return 1;
+    }
+    if (argc == 5)
+    {
+        rf_address = strtoul(argv[4], &endptr, 16);
+        if (*endptr != '\0' || rf_address == 0)
+        {
+            printf("Error : bad device address\n");
+            return 1;
+        }
+    }
+
+    res = query_log(stdout, argv[1], from, to, rf_address);
+    if (res < 0)
+    {
+        printf("Error : cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Replay a capture file, printing what was received and comparing the Hello
+ * bursts with a configuration file if one is given */
+int replay(const char* program, int argc, char *argv[])
+{
+    static const char *modes[] = {"fast", "timed", "parse"};
+    struct ruleset *rs = NULL;
+    const char *conf = NULL;
+    int mode = REPLAY_FAST, i, res;
+
+    if (argc < 2 || argc > 4)
+    {
+        help(program);
+        return 1;
+    }
+    for (i = 0; argc > 2 && i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        if (strcmp(argv[2], modes[i]) == 0)
+        {
+            mode = i;
+            break;
+        }
+    }
+    if (i < sizeof(modes) / sizeof(modes[0]))
+    {
+        /* A mode was given, the configuration file comes next */
+        if (argc == 4)
+        {
+            conf = argv[3];
+        }
+    }
+    else if (argc == 3)
+    {
+        conf = argv[2];
+    }
+    else if (argc == 4)
+    {
+        help(program);
+        return 1;
+    }
+    if (conf != NULL && read_config(&rs, conf) != 0)
+    {
+        printf("Error : cannot read configuration\n");
+        return 1;
+    }
+
+    res = replay_capture(argv[1], mode, rs);
+    walklist((union cfglist*)rs, free_ruleset, NULL);
+    if (res < 0)
+    {
+        printf("Error : cannot replay %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+int set_program(const char* program, struct sockaddr_in* serv_addr,
+        int argc, char *argv[])
+{
+    struct ruleset *rs;
+    int connectionId;
+    MAX_msg_list* msg_list = NULL;
+    int result = 0;
+    const char *conf = MAX_CONFIG_FILE;
+    uint64_t start;
+
+    if (argc < 2 || argc > 3)
+    {
+        help(program);
+        return 1;
     }
 
     if (argc == 3)
@@ -650,14 +1248,14 @@ int set_program(const char* program, struct sockaddr_in* serv_addr,
 
     /* Open connection and send configuration */
     /* Connect to cube */
-    if ((connectionId = MAXConnect((struct sockaddr*)serv_addr)) < 0)
+    if ((connectionId = connect_cube(serv_addr)) < 0)
     {
         printf("Error : Could not connect to MAX!cube\n");
         return 1;
     }
 
     /* Wait for Hello message */
-    if (MaxMsgRecvTmo(connectionId, &msg_list, MSG_TMO) < 0)
+    if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0)
     {
         printf("Error : Hello message not received from MAX!cube\n");
         return 1;
@@ -668,14 +1266,17 @@ int set_program(const char* program, struct sockaddr_in* serv_addr,
 #endif
     /* Flag rules that updates configuration. We don't send unchanged
      * parameters */
+    start = startMAXStat();
     walklist((union cfglist*)rs, flag_ruleset, msg_list);
-    freeMAXpkt(&msg_list);
+    endMAXStat(MAXStatDiff, start);
 
-    /* Pack some params needed to send function */
-    send_param.connectionId = connectionId;
-    send_param.data = argv[1];
     /* Send program configuration */
-    walklist((union cfglist*)rs, send_ruleset, &send_param);
+    if (send_cmds(connectionId, msg_list, rs, send_ruleset, NULL,
+                  argv[1]) < 0)
+    {
+        result = 1;
+    }
+    freeMAXpkt(&msg_list);
 
     /* Send 'q' (quit) command*/
     msg_list = create_quit_pkt(connectionId);
@@ -705,7 +1306,6 @@ int set_mode(const char* program, struct sockaddr_in* serv_addr,
     int mode;
     int connectionId;
     struct ruleset *rs;
-    struct send_param send_param;
     struct mode_param mode_param;
     const char *conf = MAX_CONFIG_FILE;
     int result = 0;
@@ -753,14 +1353,14 @@ int set_mode(const char* program, struct sockaddr_in* serv_addr,
 
     /* Open connection and send configuration */
     /* Connect to cube */
-    if ((connectionId = MAXConnect((struct sockaddr*)serv_addr)) < 0)
+    if ((connectionId = connect_cube(serv_addr)) < 0)
     {
         printf("Error : Could not connect to MAX!cube\n");
         return 1;
     }
 
     /* Wait for Hello message */
-    if (MaxMsgRecvTmo(connectionId, &msg_list, MSG_TMO) < 0)
+    if (MaxMsgRecvUntil(connectionId, &msg_list, MSG_TMO, "L") < 0)
     {
         printf("Error : Hello message not received from MAX!cube\n");
         return 1;
@@ -769,15 +1369,20 @@ int set_mode(const char* program, struct sockaddr_in* serv_addr,
 #ifdef MAX_DEBUG
     dumpMAXHostpkt(msg_list);
 #endif
-    freeMAXpkt(&msg_list);
 
     /* Pack some params needed to send function */
-    send_param.connectionId = connectionId;
-    send_param.data = &mode_param;
     mode_param.mode = mode;
     mode_param.device_id = argv[2];
     /* Send program configuration */
-    walklist((union cfglist*)rs, send_mode, &send_param);
+    mode_param.target = NULL;
+    mode_param.count = 0;
+    if (send_cmds(connectionId, msg_list, rs, send_mode, send_mode_targets,
+                  &mode_param) < 0)
+    {
+        result = 1;
+    }
+    free(mode_param.target);
+    freeMAXpkt(&msg_list);
 
     /* Send 'q' (quit) command*/
     msg_list = create_quit_pkt(connectionId);
@@ -824,25 +1429,76 @@ int set(const char* program, struct sockaddr_in* serv_addr,
     return 1;
 }
 
-int discover(const char* program, int argc, char *argv[])
+static void print_cube(const struct MAX_cube *cube)
 {
-    struct sockaddr_storage ss;
-    struct sockaddr *sa = (struct sockaddr*)&ss;
-    struct sockaddr_in *sin = (struct sockaddr_in*)sa;
-    struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)sa;
+    const struct sockaddr *sa = (const struct sockaddr*)&cube->addr;
+    const struct Discover_Data *D_Data = &cube->D_Data;
     char buf[64];
-    uint16_t port;
     const char *res = NULL;
-    int ret;
-    struct Discover_Data D_Data;
+
+    if (sa->sa_family == AF_INET)
+    {
+        res = inet_ntop(AF_INET, &((struct sockaddr_in*)sa)->sin_addr, buf,
+                        sizeof(buf));
+    }
+    else if (sa->sa_family == AF_INET6)
+    {
+        res = inet_ntop(AF_INET6, &((struct sockaddr_in6*)sa)->sin6_addr, buf,
+                        sizeof(buf));
+    }
+    if (res == NULL)
+    {
+        printf("Error : IP address error\n");
+        return;
+    }
+    /* Port is however hardcodded */
+    printf("Max cube available at address: %s port: %d\n", buf, MAX_TCP_PORT);
+
+    snprintf(buf, sizeof(D_Data->Name) + 1, "%s", D_Data->Name);
+    printf("\tCube name:  %s\n", buf);
+
+    snprintf(buf, sizeof(D_Data->Serial_number) + 1, "%s",
+             D_Data->Serial_number);
+    printf("\tSerial no:  %s\n", buf);
+
+    printf("\tRF Address: %02x%02x%02x\n", D_Data->RF_address[0],
+        D_Data->RF_address[1], D_Data->RF_address[2]);
+
+    printf("\tFirmware:   %02x%02x\n", D_Data->Firmware_version[0],
+        D_Data->Firmware_version[1]);
+}
+
+int discover(const char* program, int argc, char *argv[])
+{
+    struct MAX_cube cubes[DISCOVER_MAX];
+    const char *serial = NULL;
+    int max = DISCOVER_MAX;
+    int ret, i;
     
-    if (argc > 1)
+    if (argc > 2)
     {
         help(program);
         return 1;
     }
+    if (argc == 2)
+    {
+        char *endptr;
+
+        /* Stop at the expected number of cubes or at the given cube */
+        max = strtol(argv[1], &endptr, 10);
+        if (*endptr != '\0')
+        {
+            serial = argv[1];
+            max = DISCOVER_MAX;
+        }
+        else if (max < 1 || max > DISCOVER_MAX)
+        {
+            printf("Error : bad number of cubes\n");
+            return 1;
+        }
+    }
 
-    ret = MAXDiscover(sa, (socklen_t)sizeof(ss), &D_Data, 2000);
+    ret = MAXDiscoverAll(cubes, max, serial, DISCOVER_TMO);
     if (ret < 0)
     {
         printf("Error : Discover error\n");
@@ -853,91 +1509,95 @@ int discover(const char* program, int argc, char *argv[])
         printf("No cube available in LAN\n");
         return 1;
     }
-    
-    if (sa->sa_family == AF_INET)
+
+    for (i = 0; i < ret; i++)
     {
-        res = inet_ntop(AF_INET, &sin->sin_addr, buf, sizeof(buf));
-        port = ntohs(sin->sin_port);
+        print_cube(&cubes[i]);
     }
-    else if (sa->sa_family == AF_INET6)
+    if (cache_store(cubes, ret) != 0)
     {
-        res = inet_ntop(AF_INET6, &sin6->sin6_addr, buf, sizeof(buf));
-        port = ntohs(sin6->sin6_port);
+        printf("Warning : cannot update discovery cache\n");
     }
-    /* Port is however hardcodded */
-    port = MAX_TCP_PORT;
-    if (res != NULL)
+    if (serial != NULL &&
+        strncmp(cubes[ret - 1].D_Data.Serial_number, serial,
+                sizeof(cubes[ret - 1].D_Data.Serial_number)) != 0)
     {
-        printf("Max cube available at address: %s port: %d\n", buf, port);
-        
-        snprintf(buf, sizeof(D_Data.Name) + 1, "%s", D_Data.Name);
-        printf("\tCube name:  %s\n", buf);
-        
-        snprintf(buf, sizeof(D_Data.Serial_number) + 1, "%s", D_Data.Serial_number);
-        printf("\tSerial no:  %s\n", buf);
-
-        printf("\tRF Address: %02x%02x%02x\n", D_Data.RF_address[0],
-            D_Data.RF_address[1], D_Data.RF_address[2]);
-
-        printf("\tFirmware:   %02x%02x\n", D_Data.Firmware_version[0],
-            D_Data.Firmware_version[1]);
-    }
-    else
-    {
-        printf("Error : IP address error\n");
+        printf("Cube %s not found\n", serial);
+        return 1;
     }
     
     return 0;
 }
 
-int main(int argc, char *argv[])
+/* Look up a cube by serial number, in the cache first then by discovery */
+static int resolve_serial(const char *serial, struct sockaddr_in *serv_addr)
 {
-    struct sockaddr_in serv_addr;
+    struct MAX_cube cubes[DISCOVER_MAX];
+    int ret;
 
-    if(argc < 4)
+    if (cache_lookup(serial, serv_addr) == 0)
     {
-        if(argc == 1)
-        {
-            help(argv[0]);
-            return 1;
-        }
-        if (strcmp(argv[1], "discover") == 0)
-        {
-            return discover(argv[0], argc - 1, &argv[1]);
-        }
-        help(argv[0]);
-        return 1;
+        return 0;
+    }
+    ret = MAXDiscoverAll(cubes, DISCOVER_MAX, serial, DISCOVER_TMO);
+    if (ret <= 0)
+    {
+        return -1;
     }
+    cache_store(cubes, ret);
+    if (strncmp(cubes[ret - 1].D_Data.Serial_number, serial,
+                sizeof(cubes[ret - 1].D_Data.Serial_number)) != 0 ||
+        cubes[ret - 1].addr.ss_family != AF_INET)
+    {
+        return -1;
+    }
+    serv_addr->sin_addr =
+        ((struct sockaddr_in*)&cubes[ret - 1].addr)->sin_addr;
 
-    memset(&serv_addr, '0', sizeof(serv_addr)); 
+    return 0;
+}
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(atoi(argv[2])); 
+/* Fill serv_addr with the address of a cube given by IP address, host name
+ * or serial number. Return zero on success */
+int resolve_cube(const char *host, const char *port,
+        struct sockaddr_in *serv_addr)
+{
+    memset(serv_addr, 0, sizeof(*serv_addr));
 
-    printf("Welcome MAX! cube\n");
+    serv_addr->sin_family = AF_INET;
+    serv_addr->sin_port = htons(atoi(port));
 
-    if(inet_pton(AF_INET, argv[1], &serv_addr.sin_addr) <= 0)
+    if(inet_pton(AF_INET, host, &serv_addr->sin_addr) <= 0)
     {
         struct addrinfo hints, *res;
         char addr[64];
+        int serial = (strlen(host) == SERIAL_LEN);
 
-        /* Not a numeric address, try to resolve it */
+        /* Not a numeric address, try a cube serial number in the cache, then
+         * a host name and finally a discovery */
         memset(&hints, 0, sizeof hints);
         hints.ai_flags = AI_CANONNAME;
         hints.ai_family = AF_INET;
         hints.ai_socktype = SOCK_DGRAM;
-        if (getaddrinfo(argv[1], NULL, &hints, &res) != 0)
+        cached_serial[0] = '\0';
+        if (serial && cache_lookup(host, serv_addr) == 0)
+        {
+            /* Known cube, discovered again if it cannot be reached */
+            memcpy(cached_serial, host, SERIAL_LEN + 1);
+        }
+        else if (getaddrinfo(host, NULL, &hints, &res) == 0)
+        {
+            /* Use first returned address */
+            serv_addr->sin_addr.s_addr =
+                ((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
+            freeaddrinfo(res);
+        }
+        else if (!serial || resolve_serial(host, serv_addr) != 0)
         {
             printf("Error : invalid address\n");
-            help(argv[0]);
-            return 1;
+            return -1;
         }
-
-        /* Use first returned address */
-        serv_addr.sin_addr.s_addr =
-            ((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
-        freeaddrinfo(res);
-        if (inet_ntop(AF_INET, &serv_addr.sin_addr, addr, sizeof(addr)) != NULL)
+        if (inet_ntop(AF_INET, &serv_addr->sin_addr, addr, sizeof(addr)) != NULL)
         {
             printf("Using IP addr: %s\n", addr);
         }
@@ -945,10 +1605,503 @@ int main(int argc, char *argv[])
         {
             /* This should not happen */
             printf("Error : invalid address\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* One line of a fleet file: <address> <port> [config_file] */
+struct fleet_cube {
+    char host[64];
+    char port[8];
+    char conf[256];
+    pid_t pid;
+    int fd;            /* Output of the worker */
+    char *out;         /* Output kept until the worker is done */
+    size_t out_len;
+    struct timespec start;
+    long ms;           /* Duration of the push */
+    int status;        /* Exit code of the worker, FLEET_TIMEOUT or
+                        * FLEET_NOSTART */
+};
+
+static long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+        (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int read_fleet(const char *fleetfile, struct fleet_cube **cubes)
+{
+    FILE *fp;
+    char line[512];
+    int count = 0, size = 0, lineno = 0;
+    struct fleet_cube *cube;
+
+    *cubes = NULL;
+    if ((fp = fopen(fleetfile, "r")) == NULL)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char host[64], port[8], conf[256];
+        int fields;
+
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '#')
+        {
+            continue;
+        }
+        fields = sscanf(line, "%63s %7s %255s", host, port, conf);
+        if (fields <= 0)
+        {
+            continue;
+        }
+        if (fields < 2)
+        {
+            printf("Error : %s line %d, expected <address> <port> "
+                   "[config_file]\n", fleetfile, lineno);
+            fclose(fp);
+            free(*cubes);
+            *cubes = NULL;
+            return -1;
+        }
+        if (count == size)
+        {
+            size = size ? size * 2 : 8;
+            cube = realloc(*cubes, size * sizeof(*cube));
+            if (cube == NULL)
+            {
+                fclose(fp);
+                free(*cubes);
+                *cubes = NULL;
+                return -1;
+            }
+            *cubes = cube;
+        }
+        cube = &(*cubes)[count++];
+        memset(cube, 0, sizeof(*cube));
+        strcpy(cube->host, host);
+        strcpy(cube->port, port);
+        strcpy(cube->conf, fields == 3 ? conf : MAX_CONFIG_FILE);
+        cube->fd = -1;
+    }
+    fclose(fp);
+
+    return count;
+}
+
+/* Push the program of one cube in a worker process. The rule set parser
+ * keeps its state in globals, so each cube gets its own process rather than
+ * a thread. The output goes to 'fd' and is reported by the parent. */
+static pid_t start_fleet_worker(const char *program, struct fleet_cube *cube)
+{
+    int pfd[2];
+    pid_t pid;
+
+    if (pipe(pfd) < 0)
+    {
+        return -1;
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        close(pfd[0]);
+        close(pfd[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        struct sockaddr_in serv_addr;
+        char *argv[] = { "program", "all", cube->conf, NULL };
+        int res = 1;
+
+        close(pfd[0]);
+        dup2(pfd[1], STDOUT_FILENO);
+        dup2(pfd[1], STDERR_FILENO);
+        close(pfd[1]);
+        /* Only this cube, the parent merges the histograms of all */
+        resetMAXStats();
+        if (resolve_cube(cube->host, cube->port, &serv_addr) == 0)
+        {
+            res = set_program(program, &serv_addr, 3, argv);
+        }
+        fflush(stdout);
+        if (stats_file != NULL)
+        {
+            /* Histograms follow the output, see end_fleet_worker */
+            size_t len = dumpMAXStats(NULL, 0);
+            char *dump = malloc(len);
+
+            if (dump != NULL)
+            {
+                dumpMAXStats(dump, len);
+                write(STDOUT_FILENO, dump, len);
+            }
+        }
+        _exit(res);
+    }
+    close(pfd[1]);
+    cube->fd = pfd[0];
+    cube->pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &cube->start);
+
+    return pid;
+}
+
+/* Collect the output of a worker, return zero once it is done */
+static int read_fleet_worker(struct fleet_cube *cube)
+{
+    char buf[4096];
+    ssize_t n;
+    char *out;
+
+    n = read(cube->fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+    {
+        return 1;
+    }
+    if (n <= 0)
+    {
+        return 0;
+    }
+    out = realloc(cube->out, cube->out_len + n);
+    if (out == NULL)
+    {
+        /* Drop the output, the worker is still waited for */
+        return 1;
+    }
+    memcpy(out + cube->out_len, buf, n);
+    cube->out = out;
+    cube->out_len += n;
+
+    return 1;
+}
+
+static void end_fleet_worker(struct fleet_cube *cube, int killed)
+{
+    int wstatus;
+
+    close(cube->fd);
+    cube->fd = -1;
+    if (killed)
+    {
+        kill(cube->pid, SIGKILL);
+    }
+    while (waitpid(cube->pid, &wstatus, 0) < 0 && errno == EINTR)
+        ; /* nothing */
+    cube->ms = elapsed_ms(&cube->start);
+    if (killed)
+    {
+        cube->status = FLEET_TIMEOUT;
+    }
+    else if (WIFEXITED(wstatus))
+    {
+        cube->status = WEXITSTATUS(wstatus);
+    }
+    else
+    {
+        /* Crashed, reported as failed like a shell would */
+        cube->status = 128 + WTERMSIG(wstatus);
+    }
+    if (stats_file != NULL && !killed)
+    {
+        size_t len = dumpMAXStats(NULL, 0);
+
+        if (cube->out_len >= len &&
+            mergeMAXStats(cube->out + cube->out_len - len, len) == 0)
+        {
+            cube->out_len -= len;
+        }
+    }
+
+    /* Report each cube in one block, workers don't interleave */
+    printf("==== %s:%s (%s) ====\n", cube->host, cube->port, cube->conf);
+    fwrite(cube->out, 1, cube->out_len, stdout);
+    if (killed)
+    {
+        printf("Error : no answer in %d s, push abandoned\n",
+               FLEET_CUBE_TMO / 1000);
+    }
+    fflush(stdout);
+    free(cube->out);
+    cube->out = NULL;
+    cube->out_len = 0;
+}
+
+int fleet(const char* program, int argc, char *argv[])
+{
+    struct fleet_cube *cubes;
+    struct pollfd *pfds;
+    int *active;
+    int count, workers = FLEET_WORKERS;
+    int next = 0, running = 0, failed = 0;
+    int i;
+    struct timespec start;
+
+    if (argc < 2 || argc > 3)
+    {
+        help(program);
+        return 1;
+    }
+    if (argc == 3)
+    {
+        char *endptr;
+
+        workers = strtol(argv[2], &endptr, 10);
+        if (*endptr != '\0' || workers < 1 || workers > FLEET_WORKERS_MAX)
+        {
+            printf("Error : bad number of workers\n");
+            return 1;
+        }
+    }
+
+    count = read_fleet(argv[1], &cubes);
+    if (count < 0)
+    {
+        printf("Error : cannot read fleet file\n");
+        return 1;
+    }
+    if (workers > count)
+    {
+        workers = count;
+    }
+    pfds = malloc((workers + 1) * sizeof(*pfds));
+    active = malloc((workers + 1) * sizeof(*active));
+    if (pfds == NULL || active == NULL)
+    {
+        free(pfds);
+        free(active);
+        free(cubes);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (next < count || running > 0)
+    {
+        int res, tmo = FLEET_CUBE_TMO;
+
+        /* Keep the pool full */
+        while (running < workers && next < count)
+        {
+            if (start_fleet_worker(program, &cubes[next]) < 0)
+            {
+                cubes[next].status = FLEET_NOSTART;
+                printf("==== %s:%s (%s) ====\nError : cannot start worker\n",
+                       cubes[next].host, cubes[next].port, cubes[next].conf);
+            }
+            else
+            {
+                running++;
+            }
+            next++;
+        }
+
+        /* Wait for output of any worker, up to the closest deadline */
+        running = 0;
+        for (i = 0; i < next; i++)
+        {
+            if (cubes[i].fd >= 0)
+            {
+                long left = FLEET_CUBE_TMO - elapsed_ms(&cubes[i].start);
+
+                if (left < 0)
+                {
+                    end_fleet_worker(&cubes[i], 1);
+                    continue;
+                }
+                if (left < tmo)
+                {
+                    tmo = left;
+                }
+                pfds[running].fd = cubes[i].fd;
+                pfds[running].events = POLLIN;
+                active[running++] = i;
+            }
+        }
+        if (running == 0)
+        {
+            continue;
+        }
+        res = poll(pfds, running, tmo);
+        if (res < 0 && errno != EINTR)
+        {
+            break;
+        }
+        for (i = 0; res > 0 && i < running; i++)
+        {
+            if (pfds[i].revents != 0 &&
+                read_fleet_worker(&cubes[active[i]]) == 0)
+            {
+                end_fleet_worker(&cubes[active[i]], 0);
+            }
+        }
+        /* Finished workers free a slot for the next cube */
+        for (i = 0, running = 0; i < next; i++)
+        {
+            running += (cubes[i].fd >= 0);
+        }
+    }
+
+    printf("==== Fleet summary ====\n");
+    for (i = 0; i < count; i++)
+    {
+        printf("%-24s %-6s %-7s %7ld ms  %s\n", cubes[i].host,
+               cubes[i].port, cubes[i].status == 0 ? "OK" :
+               cubes[i].status == FLEET_TIMEOUT ? "TIMEOUT" :
+               cubes[i].status == FLEET_NOSTART ? "NOSTART" : "FAILED",
+               cubes[i].ms,
+               cubes[i].conf);
+        failed += (cubes[i].status != 0);
+    }
+    printf("%d cubes, %d failed, %d workers, %ld ms\n", count, failed, workers,
+           elapsed_ms(&start));
+
+    free(pfds);
+    free(active);
+    free(cubes);
+
+    return failed ? 1 : 0;
+}
+
+static void print_stats(void)
+{
+    printMAXStats(stats_file);
+    if (stats_file != stderr)
+    {
+        fclose(stats_file);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in serv_addr;
+    static struct option long_options[] = {
+        {"window", required_argument, NULL, 'w'},
+        {"format", required_argument, NULL, 'f'},
+        {"capture", required_argument, NULL, 'c'},
+        {"stats", optional_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt, i;
+
+    /* Decode C and L messages only when a command reads them */
+    setMAXDecodeMode(MAXDecodeLazy);
+    /* A dropped link must show up as a send error, not kill the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Options come before the address, command parameters are left alone */
+    while ((opt = getopt_long(argc, argv, "+w:f:c:", long_options, NULL)) != -1)
+    {
+        char *endptr;
+
+        switch (opt)
+        {
+            case 'w':
+                cmd_window = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || cmd_window < 1 ||
+                    cmd_window > MAX_CMD_WINDOW_MAX)
+                {
+                    printf("Error : bad window size\n");
+                    return 1;
+                }
+                break;
+            case 'f':
+                for (i = 0; i < sizeof(log_formats) / sizeof(log_formats[0]);
+                     i++)
+                {
+                    if (strcmp(optarg, log_formats[i].name) == 0)
+                    {
+                        break;
+                    }
+                }
+                if (i == sizeof(log_formats) / sizeof(log_formats[0]))
+                {
+                    printf("Error : bad log format\n");
+                    return 1;
+                }
+                log_format = log_formats[i].format;
+                break;
+            case 'c':
+                if (openMAXCapture(optarg) < 0)
+                {
+                    printf("Error : cannot open capture file %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                if (stats_file != NULL)
+                {
+                    break;
+                }
+                stats_file = (optarg != NULL) ? fopen(optarg, "w") : stderr;
+                if (stats_file == NULL)
+                {
+                    printf("Error : cannot open stats file %s\n", optarg);
+                    return 1;
+                }
+                enableMAXStats(1);
+                atexit(print_stats);
+                break;
+            default:
+                help(argv[0]);
+                return 1;
+        }
+    }
+    /* Drop the options, keep the program name in argv[0] */
+    argv[optind - 1] = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc > 1 && strcmp(argv[1], "fleet") == 0)
+    {
+        return fleet(argv[0], argc - 1, &argv[1]);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "convert") == 0)
+    {
+        return convert(argv[0], argc - 1, &argv[1]);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "query") == 0)
+    {
+        return query(argv[0], argc - 1, &argv[1]);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "replay") == 0)
+    {
+        return replay(argv[0], argc - 1, &argv[1]);
+    }
+
+    if(argc < 4)
+    {
+        if(argc == 1)
+        {
             help(argv[0]);
             return 1;
         }
-    } 
+        if (strcmp(argv[1], "discover") == 0)
+        {
+            return discover(argv[0], argc - 1, &argv[1]);
+        }
+        help(argv[0]);
+        return 1;
+    }
+
+    printf("Welcome MAX! cube\n");
+
+    if (resolve_cube(argv[1], argv[2], &serv_addr) != 0)
+    {
+        help(argv[0]);
+        return 1;
+    }
 
     if (strcmp(argv[3], "get") == 0)
     {
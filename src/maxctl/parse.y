@@ -98,6 +98,7 @@ device      : DEVICE STRING '{' config '}' ';' {
                     dc = (struct device_config*)
                         malloc(sizeof(struct device_config));
                     dc->config.room_id = NOT_CONFIGURED_UL;
+                    dc->config.changed_days = 0;
                     dc->config.auto_schedule = NULL;
                 }
                 dc->rf_address = strtol($2, &endptr, 16);
@@ -128,6 +129,7 @@ config      : /* empty */ { $$ = NULL; }
                     dc->config.eco_temp = NOT_CONFIGURED_F;
                     dc->config.comfort_temp = NOT_CONFIGURED_F;
                     dc->config.skip = 0;
+                    dc->config.changed_days = 0;
                     dc->config.auto_schedule = NULL;
                 }
                 else
@@ -233,7 +235,8 @@ schedule    : /* empty */ { $$ = NULL; }
             | schedule '\n'
             | schedule STRING '{' program '}' ';' {
                 struct auto_schedule *as;
-                int index;
+                struct program *pm;
+                int index, count = 0;
 
                 as = (struct auto_schedule*)
                      malloc(sizeof(struct auto_schedule));
@@ -243,12 +246,23 @@ schedule    : /* empty */ { $$ = NULL; }
                     yyerror("invalid day of the week");
                     YYERROR;
                 }
+                for (pm = $4; pm != NULL; pm = pm->next)
+                {
+                    count++;
+                }
+                if (count > MAX_CMD_SETPOINTS)
+                {
+                    /* More cannot be sent in one 's' command */
+                    yyerror("too many set points in a day, at most 7");
+                    YYERROR;
+                }
                 as->day = (uint16_t) index;
 #ifdef MAX_PARSER_DEBUG
                 printf("schedule day: %s %d\n", $2, as->day);
 #endif
                 as->skip = 0;
                 as->schedule = $4;
+                pack_auto_schedule(as);
                 free($2);
                 as->next = NULL;
                 if ($1 != NULL)
@@ -0,0 +1,295 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "max.h"
+#include "maxmsg.h"
+#include "maxcap.h"
+#include "maxstats.h"
+#include "replay.h"
+
+/* Most connections open at the same time in a capture, e.g. fleet workers */
+#define REPLAY_STREAMS 64
+
+struct replay_stream {
+    uint32_t id;
+    MAX_framer *framer;
+    MAX_msg_list *msg_list;
+};
+
+struct replay_stats {
+    int streams;
+    long chunks;
+    long bytes;
+    long sent;
+    long messages;
+};
+
+static const char* week_days[] = {
+    "Saturday",
+    "Sunday",
+    "Monday",
+    "Tuesday",
+    "Wednesday",
+    "Thursday",
+    "Friday"
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Print what 'set program' would send for a device of the rule set flagged
+ * by flag_ruleset */
+static int report_ruleset(union cfglist *cl, void *param)
+{
+    MAX_msg_list *msg_list = (MAX_msg_list*)param;
+    struct config *config;
+    uint32_t rf_address;
+    int day;
+
+    if (cl == NULL || cl->ruleset.device_config == NULL)
+    {
+        return -1;
+    }
+    rf_address = cl->ruleset.device_config->rf_address;
+    config = &cl->ruleset.device_config->config;
+    if (config->room_id == NOT_CONFIGURED_UL)
+    {
+        return 0;
+    }
+    if (findMAXConfig(rf_address, msg_list) == NULL)
+    {
+        printf("device %06x: not found\n", rf_address);
+        return 0;
+    }
+    if (config->skip == 0)
+    {
+        printf("device %06x: temperatures changed\n", rf_address);
+    }
+    if (config->changed_days != 0)
+    {
+        printf("device %06x: program changed on", rf_address);
+        for (day = 0; day < sizeof(week_days) / sizeof(week_days[0]); day++)
+        {
+            if (config->changed_days & (1 << day))
+            {
+                printf(" %s", week_days[day]);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/* Handle the messages received on a stream once a device list ends them */
+static void replay_messages(struct replay_stream *stream, int mode,
+        struct ruleset *rs, int force)
+{
+    MAX_msg_list *msg;
+    int hello = 0, list = 0;
+
+    for (msg = stream->msg_list; msg != NULL; msg = msg->next)
+    {
+        hello |= (msg->MAX_msg->type == 'C');
+        list |= (msg->MAX_msg->type == 'L');
+    }
+    if (!list && !force)
+    {
+        return;
+    }
+    if (mode == REPLAY_PARSE)
+    {
+        /* Decode everything the printers would */
+        for (msg = stream->msg_list; msg != NULL; msg = msg->next)
+        {
+            getMAXmsg(msg);
+        }
+    }
+    else if (stream->msg_list != NULL)
+    {
+        dumpMAXHostpkt(stream->msg_list);
+        if (rs != NULL && hello)
+        {
+            uint64_t start = startMAXStat();
+
+            walklist((union cfglist*)rs, flag_ruleset, stream->msg_list);
+            endMAXStat(MAXStatDiff, start);
+            walklist((union cfglist*)rs, report_ruleset, stream->msg_list);
+        }
+    }
+    freeMAXpkt(&stream->msg_list);
+}
+
+static void end_stream(struct replay_stream *stream, int mode,
+        struct ruleset *rs)
+{
+    replay_messages(stream, mode, rs, 1);
+    freeMAXFramer(stream->framer);
+    stream->framer = NULL;
+}
+
+/* Return the stream of a record, start it if needed */
+static struct replay_stream* find_stream(struct replay_stream *streams,
+        uint32_t id, struct replay_stats *stats)
+{
+    struct replay_stream *free_stream = NULL;
+    int i;
+
+    for (i = 0; i < REPLAY_STREAMS; i++)
+    {
+        if (streams[i].framer != NULL && streams[i].id == id)
+        {
+            return &streams[i];
+        }
+        if (streams[i].framer == NULL && free_stream == NULL)
+        {
+            free_stream = &streams[i];
+        }
+    }
+    if (free_stream == NULL ||
+        (free_stream->framer = createMAXFramer()) == NULL)
+    {
+        return NULL;
+    }
+    free_stream->id = id;
+    free_stream->msg_list = NULL;
+    stats->streams++;
+    return free_stream;
+}
+
+/* Wait until the capture time 'time' is reached, in replay time */
+static void wait_until(uint64_t start, uint64_t base, uint64_t time)
+{
+    uint64_t due = start + (time - base), now = now_ns();
+    struct timespec ts;
+
+    if (due <= now)
+    {
+        return;
+    }
+    ts.tv_sec = (due - now) / 1000000000ULL;
+    ts.tv_nsec = (due - now) % 1000000000ULL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+int replay_capture(const char *path, int mode, struct ruleset *rs)
+{
+    struct replay_stream streams[REPLAY_STREAMS];
+    struct replay_stats stats;
+    struct MAX_cap_record rec;
+    MAX_cap_map map;
+    const char *data;
+    size_t offset = 0;
+    uint64_t start, base = 0, elapsed;
+    int i, n, res, open_streams = 0;
+
+    if (mapMAXCapture(path, &map) < 0)
+    {
+        return -1;
+    }
+    memset(streams, 0, sizeof(streams));
+    memset(&stats, 0, sizeof(stats));
+    start = now_ns();
+    while ((res = nextMAXCapture(&map, &offset, &rec, &data)) > 0)
+    {
+        struct replay_stream *stream;
+
+        if (mode == REPLAY_TIMED)
+        {
+            /* Idle time between sessions is skipped */
+            if (base == 0 || (open_streams == 0 && rec.dir == MAXCapOpen))
+            {
+                base = rec.time - (now_ns() - start);
+            }
+            wait_until(start, base, rec.time);
+        }
+        stream = find_stream(streams, rec.stream, &stats);
+        if (stream == NULL)
+        {
+            fprintf(stderr, "Error : too many connections in the capture\n");
+            break;
+        }
+        switch (rec.dir)
+        {
+            case MAXCapOpen:
+                open_streams++;
+                break;
+            case MAXCapClose:
+                end_stream(stream, mode, rs);
+                if (open_streams > 0)
+                {
+                    open_streams--;
+                }
+                break;
+            case MAXCapRecv:
+                n = feedMAXFramer(stream->framer, data, rec.len,
+                                  &stream->msg_list);
+                if (n > 0)
+                {
+                    stats.messages += n;
+                    replay_messages(stream, mode, rs, 0);
+                }
+                stats.chunks++;
+                stats.bytes += rec.len;
+                break;
+            case MAXCapSend:
+                stats.sent++;
+                break;
+        }
+    }
+    for (i = 0; i < REPLAY_STREAMS; i++)
+    {
+        if (streams[i].framer != NULL)
+        {
+            end_stream(&streams[i], mode, rs);
+        }
+    }
+    elapsed = now_ns() - start;
+    unmapMAXCapture(&map);
+    fflush(stdout);
+
+    fprintf(stderr, "replay: %d connections, %ld chunks, %ld bytes, "
+            "%ld messages received, %ld sent in %.3f ms",
+            stats.streams, stats.chunks, stats.bytes, stats.messages,
+            stats.sent, elapsed / 1e6);
+    if (elapsed > 0)
+    {
+        fprintf(stderr, " (%.1f MB/s)", stats.bytes * 1e3 / elapsed);
+    }
+    fprintf(stderr, "\n");
+    /* 'res' is 0 at the end of the capture, positive if stopped early */
+    if (res < 0)
+    {
+        fprintf(stderr, "Error : %s is truncated\n", path);
+    }
+    return (res != 0) ? -1 : 0;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "max_parser.h"
+
+/* Replay modes */
+#define REPLAY_FAST  0 /* at full speed, printing like 'get status' */
+#define REPLAY_TIMED 1 /* same output, chunks delivered in original timing */
+#define REPLAY_PARSE 2 /* at full speed, messages decoded but not printed */
+
+/* replay_capture feeds the chunks received in the capture file 'path' to
+ * the framer of their connection, as MaxMsgRecv does, so that read splits
+ * are the original ones. Each device list received is printed with the
+ * messages before it, and when 'rs' is not NULL each Hello burst is
+ * compared with the rule set like 'set program' does. Statistics are written
+ * to stderr. Return negative if the capture cannot be read. */
+int replay_capture(const char *path, int mode, struct ruleset *rs);
+
+#endif /* REPLAY_H */
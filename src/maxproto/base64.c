@@ -26,6 +26,13 @@
 
 #include "base64.h"
 
+/* Vectorized decoder is built for x86 with GCC compatible compilers and
+ * selected at run time if the CPU supports it */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_SIMD
+#include <immintrin.h>
+#endif
+
 /* Function that transforms 6 bit values to ASCII char */
 static char base64_index_table[] =
     {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
@@ -34,42 +41,47 @@ static char base64_index_table[] =
      'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
 
-/* This is the inverse function of base64_index_table */
-static char *inv_base64_index_table = NULL;
+/* This is the inverse function of base64_index_table, -1 marks the chars
+ * outside of the base64 alphabet (the '=' padding included) */
+static const signed char inv_base64_index_table[256] = {
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  62,  -1,  -1,  -1,  63,
+      52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+      15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  -1,  -1,  -1,  -1,  -1,
+      -1,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+      41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,
+      -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1,  -1
+};
 
+/* Kept for compatibility, the inverse table is built at compile time */
 void create_inv_base64_index_table()
 {
-    int i;
-    inv_base64_index_table = malloc(256);
-
-    for (i = 0; i < 64; i++)
-    {
-        inv_base64_index_table[(unsigned char) base64_index_table[i]] = i;
-    }
 }
 
 void free_inv_base64_index_table()
 {
-    free(inv_base64_index_table);
 }
 
-char *hex_to_base64(const unsigned char *data, size_t data_sz,
-        size_t output_off, size_t output_pad, size_t *output_sz)
+int hex_to_base64_buf(const unsigned char *data, size_t data_sz,
+        char *output, size_t output_sz)
 {
     int i, j;
-    char *base64_text;
 
-    /* Compute final size of output */
-    *output_sz = 4 * ((data_sz + 2) / 3);
-    base64_text = malloc(*output_sz + output_off + output_pad);
-
-    if (base64_text == NULL)
+    if (output_sz < BASE64_ENCODED_SZ(data_sz))
     {
-        output_sz = 0;
-        return NULL;
+        return -1;
     }
 
-    for (i = 0, j = output_off; i < data_sz;)
+    for (i = 0, j = 0; i < data_sz;)
     {
         uint32_t B0, B1, B2, tmp;
         
@@ -82,97 +94,346 @@ char *hex_to_base64(const unsigned char *data, size_t data_sz,
         tmp = (B0 << 16) + (B1 << 8) + B2;
 
         /* Take every 6 bits and store into one element of output array */
-        base64_text[j++] = base64_index_table[(tmp >> 18) & 0b00111111];
-        base64_text[j++] = base64_index_table[(tmp >> 12) & 0b00111111];
-        base64_text[j++] = base64_index_table[(tmp >> 6) & 0b00111111];
-        base64_text[j++] = base64_index_table[tmp & 0b00111111];
+        output[j++] = base64_index_table[(tmp >> 18) & 0b00111111];
+        output[j++] = base64_index_table[(tmp >> 12) & 0b00111111];
+        output[j++] = base64_index_table[(tmp >> 6) & 0b00111111];
+        output[j++] = base64_index_table[tmp & 0b00111111];
     }
 
     /* Add padding with '=' to get a length divisible by 3 */
-    j = data_sz % 3;
-    if (j != 0)
+    i = data_sz % 3;
+    if (i != 0)
     {
-        j = 3 - j;
-        for (i = 0; i < j; i++)
+        output[j - 1] = '=';
+        if (i == 1)
         {
-            base64_text[*output_sz - 1 - i + output_off] = '=';
+            output[j - 2] = '=';
         }
     }
 
-    return base64_text;
+    return j;
 }
 
-unsigned char *base64_to_hex(const char *data, size_t data_sz,
+char *hex_to_base64(const unsigned char *data, size_t data_sz,
         size_t output_off, size_t output_pad, size_t *output_sz)
 {
-    unsigned char *hex_data;
-    int i, j;
-    size_t pad_off;
+    char *base64_text;
+
+    /* Compute final size of output */
+    *output_sz = BASE64_ENCODED_SZ(data_sz);
+    base64_text = malloc(*output_sz + output_off + output_pad);
 
-    /* Initialize inverse function which transforms base64 chars to 6 bit
-     * values. */
-    if (inv_base64_index_table == NULL)
+    if (base64_text == NULL)
     {
-        create_inv_base64_index_table();
+        *output_sz = 0;
+        return NULL;
     }
 
+    hex_to_base64_buf(data, data_sz, base64_text + output_off, *output_sz);
+    return base64_text;
+}
+
+int base64_decoded_size(const char *data, size_t data_sz)
+{
+    int size;
+
     /* Length of input data has to be divisible by 4 */
     if (data_sz % 4 != 0)
     {
-        *output_sz = 0;
-        printf("base64_to_hex error: Bad input length!\n");
-        return NULL;
+        return -1;
+    }
+    if (data_sz == 0)
+    {
+        return 0;
     }
 
-    /* Compute final size of output data */
-    *output_sz = data_sz / 4 * 3;
+    size = data_sz / 4 * 3;
     /* Adjust according to padding at the end. One '=' symbol means one byte
      * less */
     if (data[data_sz - 1] == '=')
     {
-        (*output_sz)--;
+        size--;
     }
     if (data[data_sz - 2] == '=')
     {
-        (*output_sz)--;
+        size--;
     }
+    return size;
+}
 
-    hex_data = malloc(*output_sz + output_off + output_pad);
-    /* Calculate padding offset */
-    pad_off = output_off + (*output_sz);
-    if (hex_data == NULL)
+#ifdef BASE64_SIMD
+/* Translate 16 base64 chars to 6 bit values and pack them in 12 bytes at the
+ * beginning of the register. Return 0 if an invalid char (including the '='
+ * padding) is found. */
+__attribute__((target("ssse3"), always_inline))
+static inline int base64_dec_16(__m128i *str)
+{
+    /* Lookup tables indexed by the low and high nibble of a char. A char is
+     * valid if the values of its nibbles have no common bit. */
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    /* Value to add to a char to get its index, by high nibble. '/' is
+     * moved to entry 1. */
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i hi_nibbles, lo_nibbles, hi, lo, roll, merged;
+
+    hi_nibbles = _mm_and_si128(_mm_srli_epi32(*str, 4), mask_2f);
+    lo_nibbles = _mm_and_si128(*str, mask_2f);
+    hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                         _mm_setzero_si128())) != 0)
     {
-        *output_sz = 0;
-        return NULL;
+        return 0;
+    }
+    roll = _mm_shuffle_epi8(lut_roll,
+               _mm_add_epi8(_mm_cmpeq_epi8(*str, mask_2f), hi_nibbles));
+    *str = _mm_add_epi8(*str, roll);
+
+    /* Merge 4 x 6 bits into 24 bits in each 32 bit lane and store the 3
+     * bytes in network order */
+    merged = _mm_maddubs_epi16(*str, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    *str = _mm_shuffle_epi8(merged, _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return 1;
+}
+
+/* Decode blocks of 16 chars. Every block writes 16 bytes of which 12 are
+ * valid, so the loop stops while at least 8 chars are left for the scalar
+ * code. Return the number of chars decoded. Inlined in the AVX2 decoder as
+ * well, to avoid mixing legacy SSE and AVX encoded instructions. */
+__attribute__((target("ssse3"), always_inline))
+static inline size_t base64_dec_loop16(const char *data, size_t data_sz,
+        unsigned char *out)
+{
+    size_t i = 0;
+
+    while (i + 16 + 8 <= data_sz)
+    {
+        __m128i str = _mm_loadu_si128((const __m128i*)(data + i));
+
+        if (!base64_dec_16(&str))
+        {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)out, str);
+        i += 16;
+        out += 12;
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_dec_ssse3(const char *data, size_t data_sz,
+        unsigned char *out)
+{
+    return base64_dec_loop16(data, data_sz, out);
+}
+
+/* Decode blocks of 32 chars, same as base64_dec_ssse3 on 256 bit registers.
+ * Every block writes 32 bytes of which 24 are valid. */
+__attribute__((target("avx2")))
+static size_t base64_dec_avx2(const char *data, size_t data_sz,
+        unsigned char *out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i shuf = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+
+    while (i + 32 + 16 <= data_sz)
+    {
+        __m256i str, hi_nibbles, lo_nibbles, hi, lo, roll, merged;
+
+        str = _mm256_loadu_si256((const __m256i*)(data + i));
+        hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        lo_nibbles = _mm256_and_si256(str, mask_2f);
+        hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+        {
+            break;
+        }
+        roll = _mm256_shuffle_epi8(lut_roll,
+                   _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f),
+                                   hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, shuf);
+        /* Join the 12 valid bytes of both lanes */
+        merged = _mm256_permutevar8x32_epi32(merged,
+                     _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i*)out, merged);
+        i += 32;
+        out += 24;
+    }
+    /* Leftover blocks of 16 chars */
+    return i + base64_dec_loop16(data + i, data_sz - i, out);
+}
+#endif /* BASE64_SIMD */
+
+typedef size_t (*base64_dec_fn)(const char *data, size_t data_sz,
+        unsigned char *out);
+
+static int base64_dec_type = -1;
+static base64_dec_fn base64_dec_bulk = NULL;
+
+int base64_set_decoder(int type)
+{
+    switch (type)
+    {
+        case Base64Scalar:
+            base64_dec_bulk = NULL;
+            break;
+#ifdef BASE64_SIMD
+        case Base64SSSE3:
+            if (!__builtin_cpu_supports("ssse3"))
+            {
+                return -1;
+            }
+            base64_dec_bulk = base64_dec_ssse3;
+            break;
+        case Base64AVX2:
+            if (!__builtin_cpu_supports("avx2") ||
+                !__builtin_cpu_supports("ssse3"))
+            {
+                return -1;
+            }
+            base64_dec_bulk = base64_dec_avx2;
+            break;
+#endif
+        default:
+            return -1;
+    }
+    base64_dec_type = type;
+    return 0;
+}
+
+int base64_decoder()
+{
+    if (base64_dec_type < 0)
+    {
+        /* Pick the widest decoder supported by the CPU */
+        if (base64_set_decoder(Base64AVX2) != 0 &&
+            base64_set_decoder(Base64SSSE3) != 0)
+        {
+            base64_set_decoder(Base64Scalar);
+        }
+    }
+    return base64_dec_type;
+}
+
+int base64_to_hex_buf(const char *data, size_t data_sz,
+        unsigned char *output, size_t output_sz)
+{
+    int size, i, j;
+
+    size = base64_decoded_size(data, data_sz);
+    if (size < 0 || output_sz < size)
+    {
+        return -1;
     }
 
-    for (i = 0, j = output_off; i < data_sz;)
+    i = 0;
+    j = 0;
+    /* Decode the bulk of the data with the vectorized decoder, if any. It
+     * stops before the padding and on invalid input, the remaining chars are
+     * decoded below. */
+    if (base64_decoder() != Base64Scalar)
+    {
+        i = base64_dec_bulk(data, data_sz, output);
+        j = i / 4 * 3;
+    }
+    while (i < data_sz)
     {
         uint32_t tmp = 0, k;
         /* Group 4 elements containing 6 bits values to be split into 3 bytes */
         for (k = 0; k < 4; k++)
         {
-            tmp = (tmp << 6);
-            tmp |= (data[i] == '=') ? 0 : inv_base64_index_table[(int)data[i]];
+            int val = inv_base64_index_table[(unsigned char)data[i]];
+
+            if (val < 0)
+            {
+                if (data[i] != '=')
+                {
+                    return -1;
+                }
+                val = 0;
+            }
+            tmp = (tmp << 6) | val;
             i++;
         }
 
         /* Split 24 bits into 3 bytes */
-        if (j < pad_off)
+        if (j < size)
         {
-            hex_data[j++] = (tmp >> 16) & 0xFF;
+            output[j++] = (tmp >> 16) & 0xFF;
         }
-        if (j < pad_off)
+        if (j < size)
         {
-            hex_data[j++] = (tmp >> 8) & 0xFF;
+            output[j++] = (tmp >> 8) & 0xFF;
         }
-        if (j < pad_off)
+        if (j < size)
         {
-            hex_data[j++] = tmp & 0xFF;
+            output[j++] = tmp & 0xFF;
         }
     }
 
-    return hex_data;
+    return size;
 }
 
+unsigned char *base64_to_hex(const char *data, size_t data_sz,
+        size_t output_off, size_t output_pad, size_t *output_sz)
+{
+    unsigned char *hex_data;
+    int size;
 
+    size = base64_decoded_size(data, data_sz);
+    if (size < 0)
+    {
+        *output_sz = 0;
+        printf("base64_to_hex error: Bad input length!\n");
+        return NULL;
+    }
+
+    hex_data = malloc(size + output_off + output_pad);
+    if (hex_data == NULL)
+    {
+        *output_sz = 0;
+        return NULL;
+    }
+
+    if (base64_to_hex_buf(data, data_sz, hex_data + output_off, size) < 0)
+    {
+        free(hex_data);
+        *output_sz = 0;
+        return NULL;
+    }
+    *output_sz = size;
+    return hex_data;
+}
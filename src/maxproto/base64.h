@@ -22,8 +22,46 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <stddef.h>
+
+/* Implementations of the base64 decoder */
+enum Base64Decoder
+{
+    Base64Scalar = 0,
+    Base64SSSE3 = 1,
+    Base64AVX2 = 2
+};
+
+/* Return the decoder in use. The first call selects the fastest one supported
+ * by the CPU. */
+int base64_decoder();
+/* Force a decoder. Return 0 on success, -1 if not supported by this CPU or
+ * build. */
+int base64_set_decoder(int type);
+
+/* Number of chars needed to encode 'n' bytes */
+#define BASE64_ENCODED_SZ(n) (4 * (((n) + 2) / 3))
+
+/* Kept for compatibility, nothing to set up anymore */
 void create_inv_base64_index_table();
 void free_inv_base64_index_table();
+
+/* Encode 'data_sz' bytes in the caller supplied 'output' buffer of
+ * 'output_sz' chars. No terminator is added. Return the number of chars
+ * written or -1 if the buffer is too small. */
+int hex_to_base64_buf(const unsigned char *data, size_t data_sz,
+        char *output, size_t output_sz);
+/* Return the number of bytes encoded in 'data', -1 if the length is not
+ * valid */
+int base64_decoded_size(const char *data, size_t data_sz);
+/* Decode 'data_sz' chars in the caller supplied 'output' buffer of
+ * 'output_sz' bytes. Return the number of bytes written, -1 if the input is
+ * not valid base64 or the buffer is too small. */
+int base64_to_hex_buf(const char *data, size_t data_sz,
+        unsigned char *output, size_t output_sz);
+
+/* Allocating variants, the result is placed at 'output_off' in a buffer with
+ * 'output_pad' spare bytes at the end */
 char *hex_to_base64(const unsigned char *data, size_t data_sz,
         size_t output_off, size_t output_pad, size_t *output_sz);
 unsigned char *base64_to_hex(const char *data, size_t data_sz,
@@ -20,212 +20,567 @@
  */ 
 
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <ifaddrs.h>
+#include <time.h>
 
 #include "maxmsg.h"
 #include "max.h"
 #include "base64.h"
+#include "maxcap.h"
+#include "maxstats.h"
+
+/* Receive buffer initial size, large enough for a complete Hello burst of a
+ * small installation. It grows up to MAX_RECV_BUF_MAX when a single message
+ * doesn't fit. */
+#define MAX_RECV_BUF_SZ 4096
+#define MAX_RECV_BUF_MAX (64 * 1024)
+
+/* Messages gathered by one writev call, well below IOV_MAX */
+#define MAX_SEND_IOV 64
+
+/* struct MAX_framer keeps the reassembly state of a byte stream. Bytes are
+ * read straight into 'buf' and complete messages are parsed in place. Data
+ * between 'start' and 'end' has not been consumed yet, 'scan' is the position
+ * where the search for the message terminator resumes after the next read. */
+struct MAX_framer {
+    char *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    size_t scan;
+};
+
+/* Decoding of C and L messages, see setMAXDecodeMode */
+static int decode_mode = MAXDecodeEager;
+
+/* Framers of the open connections, indexed by socket descriptor */
+static MAX_framer *conn_framer[FD_SETSIZE];
+
+/* Return a pointer to the first message terminator in 'data' or NULL if the
+ * terminator is not found in the first 'size' bytes */
+static const char* findMAXMsgEnd(const char *data, size_t size)
+{
+    const char *end = data + size;
+    const char *p = data;
 
-int parseMAXData(char *MAXData, int size, MAX_msg_list** msg_list)
+    while (p < end && (p = memchr(p, MSG_END[0], end - p)) != NULL)
+    {
+        if (p + 1 < end && p[1] == MSG_END[1])
+        {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Allocate memory for a message in the arena of the packet, or with malloc if
+ * the packet is not arena allocated */
+static void* allocMAXMsg(MAX_arena *arena, size_t size)
 {
-    char *pos = MAXData, *tmp;
-    char *end = MAXData + size - 1;
-    MAX_msg_list *new = NULL, *iter;
-    int len;
-    size_t outlen, off;
+    return (arena != NULL) ? allocMAXArena(arena, size) : malloc(size);
+}
 
-    if (MAXData == NULL)
+/* Decode the base64 payload starting at offset 'off' of a message of 'len'
+ * bytes, terminator excluded. The first 'off' bytes are copied unchanged. */
+static struct MAX_message* decodeMAXMsg(MAX_arena *arena, const char *pos,
+        size_t len, size_t off, size_t *msg_len)
+{
+    struct MAX_message *msg;
+    int outlen;
+
+    if (len < off)
     {
-        errno = EINVAL;
-        return -1;
+        return NULL;
     }
-    while (pos != NULL && pos < end)
+    len -= off;
+    outlen = base64_decoded_size(pos + off, len);
+    if (outlen < 0)
     {
-        if (*(pos + 1) != ':')
+        return NULL;
+    }
+    msg = allocMAXMsg(arena, off + outlen);
+    if (msg == NULL)
+    {
+        return NULL;
+    }
+    /* Decode straight from the receive buffer into the packet */
+    if (base64_to_hex_buf(pos + off, len, (unsigned char*)msg + off,
+                          outlen) < 0)
+    {
+        if (arena == NULL)
         {
-            errno = EBADMSG;
-            return -1;
+            free(msg);
         }
-        tmp = strstr(pos, MSG_END);
-        if (tmp == NULL)
+        return NULL;
+    }
+    memcpy(msg, pos, off);
+    *msg_len = off + outlen;
+    return msg;
+}
+
+/* Return the offset of the base64 payload in a message, zero if the message
+ * type is not base64 encoded */
+static size_t payloadMAXOffset(char type)
+{
+    switch (type)
+    {
+        case 'C':
+            /* Base64 payload follows the RF address (C_Data) */
+            return sizeof(struct MAX_message) - 1 + sizeof(struct C_Data);
+        case 'L':
+        case 's':
+            return sizeof(struct MAX_message) - 1;
+        default:
+            return 0;
+    }
+}
+
+/* Keep a base64 encoded message of 'len' bytes, terminator excluded, as
+ * received. It is decoded by getMAXmsg on first access. */
+static struct MAX_message* keepMAXMsg(MAX_arena *arena, const char *pos,
+        size_t len, size_t off, size_t *msg_len)
+{
+    struct MAX_message *msg;
+
+    if (len < off || base64_decoded_size(pos + off, len - off) < 0)
+    {
+        return NULL;
+    }
+    msg = allocMAXMsg(arena, len);
+    if (msg != NULL)
+    {
+        memcpy(msg, pos, len);
+        *msg_len = len;
+    }
+    return msg;
+}
+
+void setMAXDecodeMode(int mode)
+{
+    decode_mode = mode;
+}
+
+struct MAX_message* getMAXmsg(MAX_msg_list *msg)
+{
+    struct MAX_message *decoded;
+    size_t msg_len;
+    uint64_t start;
+
+    if (msg == NULL || msg->MAX_msg == NULL)
+    {
+        return NULL;
+    }
+    if (!msg->encoded)
+    {
+        return msg->MAX_msg;
+    }
+    start = startMAXStat();
+    decoded = decodeMAXMsg(msg->arena, (const char*)msg->MAX_msg,
+                           msg->MAX_msg_len,
+                           payloadMAXOffset(msg->MAX_msg->type), &msg_len);
+    endMAXStat(MAXStatDecode, start);
+    if (decoded == NULL)
+    {
+        return NULL;
+    }
+    if (msg->arena == NULL)
+    {
+        free(msg->MAX_msg);
+    }
+    msg->MAX_msg = decoded;
+    msg->MAX_msg_len = msg_len;
+    msg->encoded = 0;
+    return decoded;
+}
+
+/* Parse a single complete message of 'size' bytes, terminator included, and
+ * append it to msg_list. The first message of a packet creates the arena
+ * which holds all the following ones. */
+static int parseMAXMsg(const char *pos, size_t size, MAX_msg_list** msg_list)
+{
+    MAX_msg_list *new = NULL;
+    struct MAX_message *msg = NULL;
+    MAX_arena *arena, *new_arena = NULL;
+    size_t msg_len;
+    int encoded = 0;
+
+    if (size < MSG_END_LEN + 2 || pos[1] != ':')
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (*msg_list == NULL)
+    {
+        arena = new_arena = createMAXArena();
+        if (arena == NULL)
         {
-            errno = EBADMSG;
+            errno = ENOMEM;
             return -1;
         }
-        tmp += MSG_END_LEN;
-        new = (MAX_msg_list*)malloc(sizeof(MAX_msg_list));
-        if (*msg_list == NULL)
-        {
-            *msg_list = new;
-            new->prev = NULL;
-            new->next = NULL;
-        }
-        else
-        {
-            iter = *msg_list;
-            while (iter->next != NULL) {
-                iter = iter->next;
-            }
-            iter->next = new;
-            new->prev = iter;
-            new->next = NULL;
-        }
-        switch (*pos)
-        {
-            case 'H':
+    }
+    else
+    {
+        arena = (*msg_list)->arena;
+    }
+    switch (*pos)
+    {
+        case 'H':
+            msg_len = sizeof(struct MAX_message) - 1 + sizeof(struct H_Data);
+            if (size < msg_len)
             {
-                int H_len = sizeof(struct MAX_message) - 1 +
-                            sizeof(struct H_Data);
-                new->MAX_msg = malloc(H_len);
-                memcpy(new->MAX_msg, pos, H_len);
-                new->MAX_msg_len = H_len;
                 break;
             }
-            case 'C':
-                /* Calculate offset of second field (C_Data_Device) */
-                off = sizeof(struct MAX_message) - 1 + sizeof(struct C_Data);
-                /* Move to second field */
-                /* Calculate length of second field */
-                len = tmp - MSG_END_LEN - pos - off;
-                new->MAX_msg = (struct MAX_message*)base64_to_hex(pos + off,
-                               len, off, 0, &outlen);
-                if (new->MAX_msg == NULL)
-                {
-                    errno = EBADMSG;
-                    return -1;
-                }
-                memcpy(new->MAX_msg, pos, off);
-                new->MAX_msg_len = off + outlen;
-                break;
-            case 'L':
-                /* Calculate offset of payload */
-                off = sizeof(struct MAX_message) - 1;
-                /* Calculate length of data */
-                len = tmp - MSG_END_LEN - pos - off;
-                new->MAX_msg = (struct MAX_message*)base64_to_hex(pos + off,
-                               len, off, 0, &outlen);
-                if (new->MAX_msg == NULL)
-                {
-                    errno = EBADMSG;
-                    return -1;
-                }
-                memcpy(new->MAX_msg, pos, off);
-                new->MAX_msg_len = off + outlen;
-                break;
-            case 'M':
-            case 'Q':
-                new->MAX_msg = malloc(tmp - pos);
-                memcpy(new->MAX_msg, pos, tmp - pos);
-                new->MAX_msg_len = tmp - pos;
-                break;
-            case 'S':
+            msg = allocMAXMsg(arena, msg_len);
+            if (msg != NULL)
             {
-                int S_len = sizeof(struct MAX_message) - 1 +
-                            sizeof(struct S_Data);
-                new->MAX_msg = malloc(S_len);
-                memcpy(new->MAX_msg, pos, S_len);
-                new->MAX_msg_len = S_len;
-                break;
+                memcpy(msg, pos, msg_len);
             }
-            case 's':
-                /* Calculate offset of payload */
-                off = sizeof(struct MAX_message) - 1;
-                /* Calculate length of data */
-                len = tmp - MSG_END_LEN - pos - off;
-                new->MAX_msg = (struct MAX_message*)base64_to_hex(pos + off,
-                               len, off, 0, &outlen);
-                if (new->MAX_msg == NULL)
-                {
-                    errno = EBADMSG;
-                    return -1;
-                }
-                memcpy(new->MAX_msg, pos, off);
-                new->MAX_msg_len = off + outlen;
+            break;
+        case 'C':
+        case 'L':
+            if (decode_mode == MAXDecodeLazy)
+            {
+                msg = keepMAXMsg(arena, pos, size - MSG_END_LEN,
+                                 payloadMAXOffset(*pos), &msg_len);
+                encoded = 1;
                 break;
-            default:
-                new->MAX_msg = malloc(tmp - pos);
-                memcpy(new->MAX_msg, pos, tmp - pos);
+            }
+            /* fall through */
+        case 's':
+            msg = decodeMAXMsg(arena, pos, size - MSG_END_LEN,
+                               payloadMAXOffset(*pos), &msg_len);
+            break;
+        case 'S':
+            msg_len = sizeof(struct MAX_message) - 1 + sizeof(struct S_Data);
+            if (size < msg_len)
+            {
                 break;
+            }
+            msg = allocMAXMsg(arena, msg_len);
+            if (msg != NULL)
+            {
+                memcpy(msg, pos, msg_len);
+            }
+            break;
+        case 'M':
+        case 'Q':
+        default:
+            msg_len = size;
+            msg = allocMAXMsg(arena, msg_len);
+            if (msg != NULL)
+            {
+                memcpy(msg, pos, msg_len);
+            }
+            break;
+    }
+    if (msg == NULL)
+    {
+        freeMAXArena(new_arena);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    new = (MAX_msg_list*)allocMAXMsg(arena, sizeof(MAX_msg_list));
+    if (new == NULL)
+    {
+        if (arena == NULL)
+        {
+            free(msg);
         }
-        pos = tmp;
+        freeMAXArena(new_arena);
+        errno = ENOMEM;
+        return -1;
+    }
+    new->MAX_msg = msg;
+    new->MAX_msg_len = msg_len;
+    new->arena = arena;
+    new->encoded = encoded;
+    new->cfg_index = NULL;
+    new->next = NULL;
+    if (*msg_list == NULL)
+    {
+        *msg_list = new;
+        new->prev = NULL;
+        new->last = new;
+    }
+    else
+    {
+        new->prev = (*msg_list)->last;
+        new->last = NULL;
+        (*msg_list)->last->next = new;
+        (*msg_list)->last = new;
+    }
+    if (*pos == 'C')
+    {
+        /* A failure only means lookups fall back to a list search */
+        indexMAXConfig(*msg_list, new);
     }
     return 0;
 }
 
-static int addrinifaddrs(struct sockaddr *sa, struct ifaddrs *ifaddr)
+int parseMAXData(char *MAXData, int size, MAX_msg_list** msg_list)
 {
-    while (ifaddr)
+    const char *pos = MAXData, *tmp;
+    const char *end = MAXData + size;
+    uint64_t start = startMAXStat();
+
+    if (MAXData == NULL)
     {
-        if (ifaddr->ifa_addr->sa_family == sa->sa_family)
+        errno = EINVAL;
+        return -1;
+    }
+    while (pos < end)
+    {
+        tmp = findMAXMsgEnd(pos, end - pos);
+        if (tmp == NULL)
         {
-            if (sa->sa_family == AF_INET)
-            {
-                struct sockaddr_in *sin, *ifsin;
-                sin = (struct sockaddr_in*)sa;
-                ifsin = (struct sockaddr_in*)ifaddr->ifa_addr;
-                if (ifsin->sin_addr.s_addr == sin->sin_addr.s_addr)
-                {
-                    /* Found it! */
-                    return 1;
-                }
-            }
-            else
-            {
-                /* Only IPv4 supported */
-                return 0;
-            }
+            errno = EBADMSG;
+            return -1;
+        }
+        tmp += MSG_END_LEN;
+        if (parseMAXMsg(pos, tmp - pos, msg_list) != 0)
+        {
+            return -1;
         }
-        ifaddr = ifaddr->ifa_next;
+        pos = tmp;
     }
+    endMAXStat(MAXStatParse, start);
     return 0;
 }
 
-int MAXDiscover(struct sockaddr *sa, socklen_t sa_len,
-    struct Discover_Data *D_Data, int tmo)
+MAX_framer* createMAXFramer(void)
+{
+    MAX_framer *framer = malloc(sizeof(MAX_framer));
+
+    if (framer == NULL)
+    {
+        return NULL;
+    }
+    framer->buf = malloc(MAX_RECV_BUF_SZ);
+    if (framer->buf == NULL)
+    {
+        free(framer);
+        return NULL;
+    }
+    framer->size = MAX_RECV_BUF_SZ;
+    framer->start = framer->end = framer->scan = 0;
+    return framer;
+}
+
+void freeMAXFramer(MAX_framer *framer)
+{
+    if (framer != NULL)
+    {
+        free(framer->buf);
+        free(framer);
+    }
+}
+
+/* Make room for more data at the end of the framer buffer. Consumed data is
+ * dropped when the free space runs low, the buffer is enlarged only if a
+ * partial message fills it completely. */
+static int reserveMAXFramer(MAX_framer *framer)
+{
+    char *buf;
+
+    if (framer->start > 0 && framer->size - framer->end < framer->size / 4)
+    {
+        /* Move the partial message to the beginning of the buffer */
+        memmove(framer->buf, framer->buf + framer->start,
+                framer->end - framer->start);
+        framer->end -= framer->start;
+        framer->scan -= framer->start;
+        framer->start = 0;
+    }
+    if (framer->end < framer->size)
+    {
+        return 0;
+    }
+    if (framer->size >= MAX_RECV_BUF_MAX)
+    {
+        /* Message too long, drop it and resynchronize on the next
+         * terminator */
+        framer->start = framer->end = framer->scan = 0;
+        errno = EMSGSIZE;
+        return -1;
+    }
+    buf = realloc(framer->buf, framer->size * 2);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+    framer->buf = buf;
+    framer->size *= 2;
+    return 0;
+}
+
+/* Parse all complete messages available in the framer buffer. Return the
+ * number of messages appended to msg_list. Malformed messages are dropped. */
+static int drainMAXFramer(MAX_framer *framer, MAX_msg_list **msg_list)
+{
+    const char *tmp;
+    int count = 0;
+    uint64_t start = startMAXStat();
+
+    while ((tmp = findMAXMsgEnd(framer->buf + framer->scan,
+                                framer->end - framer->scan)) != NULL)
+    {
+        size_t next = tmp - framer->buf + MSG_END_LEN;
+
+        if (parseMAXMsg(framer->buf + framer->start, next - framer->start,
+                        msg_list) == 0)
+        {
+            count++;
+        }
+        framer->start = framer->scan = next;
+    }
+    /* Terminator may be split between two reads, search again from its
+     * first byte */
+    framer->scan = framer->end;
+    if (framer->end > framer->start && framer->buf[framer->end - 1] == MSG_END[0])
+    {
+        framer->scan--;
+    }
+    if (framer->start == framer->end)
+    {
+        framer->start = framer->end = framer->scan = 0;
+    }
+    /* Reads ending within a message are not worth a sample */
+    if (count > 0)
+    {
+        endMAXStat(MAXStatParse, start);
+    }
+    return count;
+}
+
+int feedMAXFramer(MAX_framer *framer, const char *data, size_t size,
+        MAX_msg_list **msg_list)
+{
+    int count = 0;
+
+    while (size > 0)
+    {
+        size_t n;
+
+        if (reserveMAXFramer(framer) != 0)
+        {
+            return -1;
+        }
+        n = framer->size - framer->end;
+        if (n > size)
+        {
+            n = size;
+        }
+        memcpy(framer->buf + framer->end, data, n);
+        framer->end += n;
+        data += n;
+        size -= n;
+        count += drainMAXFramer(framer, msg_list);
+    }
+    return count;
+}
+
+/* Read once from connection into the framer and parse the complete messages.
+ * Return the read result, the number of messages appended to msg_list is
+ * stored in 'count' */
+static int readMAXFramer(MAX_framer *framer, int connectionId,
+        MAX_msg_list **msg_list, int *count)
+{
+    int n;
+
+    *count = 0;
+    if (reserveMAXFramer(framer) != 0)
+    {
+        return -1;
+    }
+    n = read(connectionId, framer->buf + framer->end,
+             framer->size - framer->end);
+    if (n > 0)
+    {
+        struct iovec iov;
+
+        iov.iov_base = framer->buf + framer->end;
+        iov.iov_len = n;
+        captureMAXData(MAXCapRecv, connectionId, &iov, 1);
+        framer->end += n;
+        *count = drainMAXFramer(framer, msg_list);
+    }
+    return n;
+}
+
+/* Return the framer of a connection, create it if needed */
+static MAX_framer* connMAXFramer(int connectionId)
+{
+    if (connectionId < 0 || connectionId >= FD_SETSIZE)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+    if (conn_framer[connectionId] == NULL)
+    {
+        conn_framer[connectionId] = createMAXFramer();
+    }
+    return conn_framer[connectionId];
+}
+
+/* The probe is received back on the discovery port, tell it from a cube
+ * reply by its content rather than by the sender address so that a cube
+ * running on this host is still found. */
+static const char discover_pkt[] = "eQ3Max*\0**********I";
+
+static int isMAXprobe(const void *pkt, int len)
+{
+    return len == sizeof(discover_pkt) - 1 &&
+        memcmp(pkt, discover_pkt, len) == 0;
+}
+
+int MAXDiscoverAll(struct MAX_cube *cubes, int max, const char *serial,
+    int tmo)
 {
-#ifdef __CYGWIN__
-    fd_set fds;
-#endif
-    struct timeval tv;
     struct sockaddr_in sin_bcast, sin_mcast, sin;
-    int i, pkt_len, n;
-    char discover_pkt[] = "eQ3Max*\0**********I";
+    struct timespec start, now;
+    struct pollfd pfd;
+    int i, pkt_len, n, found = 0;
     int sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    int broadcast = 1;
-    struct ifaddrs *ifaddr;
-
-    if ((n = getifaddrs(&ifaddr)) != 0) {
-        close(sd);
-        return n;
-    }    
+    int on = 1;
 
-    tv.tv_sec = tmo / 1000;
-    tv.tv_usec = (tmo % 1000) * 1000;
+    if (sd < 0)
+    {
+        return -1;
+    }
 
+    memset(&sin_mcast, 0, sizeof(sin_mcast));
     sin_mcast.sin_family = AF_INET;
     sin_mcast.sin_port = htons(MAX_DISCOVER_PORT);
     inet_pton(AF_INET, MAX_MCAST_ADDR, &sin_mcast.sin_addr);
 
+    memset(&sin_bcast, 0, sizeof(sin_bcast));
     sin_bcast.sin_family = AF_INET;
     sin_bcast.sin_port = htons(MAX_DISCOVER_PORT);
     inet_pton(AF_INET, MAX_BCAST_ADDR, &sin_bcast.sin_addr);
     
+    memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
     sin.sin_port = htons(MAX_DISCOVER_PORT);
     sin.sin_addr.s_addr = htonl(INADDR_ANY);
 
-    n = bind(sd, (struct sockaddr*)&sin, sizeof(sin));
-    if (n < 0)
+    /* Several discoveries may run at the same time, e.g. fleet workers */
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(sd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
     {
-        freeifaddrs(ifaddr);
         close(sd);
-        return n;
+        return -1;
     }
     
     pkt_len = sizeof(discover_pkt) - 1;
@@ -237,16 +592,13 @@ int MAXDiscover(struct sockaddr *sa, socklen_t sa_len,
                    sizeof(sin_mcast));
         if (n < 0)
         {
-            freeifaddrs(ifaddr);
             close(sd);
             return n;
         }
     }
 
-    if (setsockopt(sd, SOL_SOCKET, SO_BROADCAST, &broadcast,
-        sizeof(broadcast)) == -1)
+    if (setsockopt(sd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) == -1)
     {
-        freeifaddrs(ifaddr);
         close(sd);
         return -1;
     }
@@ -258,116 +610,273 @@ int MAXDiscover(struct sockaddr *sa, socklen_t sa_len,
                    sizeof(sin_bcast));
         if (n < 0)
         {
-            freeifaddrs(ifaddr);
             close(sd);
             return n;
         }
     }
 
-#ifdef __CYGWIN__
-    FD_ZERO(&fds);
-    FD_SET(sd, &fds);
-
-    do {
-        n = select(sd + 1, &fds, NULL, NULL, &tv);
-        if (n == -1)
+    /* Collect replies until 'tmo' expires or the caller has what it wants */
+    pfd.fd = sd;
+    pfd.events = POLLIN;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (found < max)
+    {
+        struct MAX_cube *cube = &cubes[found];
+        socklen_t sa_len = sizeof(cube->addr);
+        char pkt[64];
+        int left;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = tmo - ((now.tv_sec - start.tv_sec) * 1000 +
+                      (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (left <= 0)
         {
-            freeifaddrs(ifaddr);
-            return -1;
+            break;
         }
-        else if (n > 0)
+        n = poll(&pfd, 1, left);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
         {
-            n = recvfrom(sd, D_Data, sizeof(struct Discover_Data), 0, sa,
-                &sa_len);
-            /* Ignore own packets */
-            if (n > 0 && addrinifaddrs(sa, ifaddr) == 0)
+            break;
+        }
+        n = recvfrom(sd, pkt, sizeof(pkt), 0, (struct sockaddr*)&cube->addr,
+                     &sa_len);
+        /* Ignore own probes and short packets */
+        if (n < (int)sizeof(struct Discover_Data) || isMAXprobe(pkt, n))
+        {
+            continue;
+        }
+        memcpy(&cube->D_Data, pkt, sizeof(cube->D_Data));
+        /* A cube answers each of the probes, keep the first reply */
+        for (i = 0; i < found; i++)
+        {
+            if (memcmp(cubes[i].D_Data.Serial_number,
+                       cube->D_Data.Serial_number,
+                       sizeof(cube->D_Data.Serial_number)) == 0)
             {
-                /* This has to be the packet we were looking for */
                 break;
             }
         }
-    } while (n > 0);
-#else
-    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,
-        sizeof(struct timeval)) < 0)
-    {
-        freeifaddrs(ifaddr);
-        return -1;
+        if (i < found)
+        {
+            continue;
+        }
+        found++;
+        if (serial != NULL &&
+            strncmp(cube->D_Data.Serial_number, serial,
+                    sizeof(cube->D_Data.Serial_number)) == 0)
+        {
+            break;
+        }
     }
 
-    do {
-            n = recvfrom(sd, D_Data, sizeof(struct Discover_Data), 0, sa,
-                &sa_len);
-            /* Ignore own packets */
-            if (n > 0 && addrinifaddrs(sa, ifaddr) == 0)
-            {
-                /* This has to be the packet we were looking for */
-                break;
-            }
-    } while (n > 0);
-#endif
-
-    freeifaddrs(ifaddr);
     close(sd);
 
-    return n;    
+    return found;
+}
+
+int MAXDiscover(struct sockaddr *sa, socklen_t sa_len,
+    struct Discover_Data *D_Data, int tmo)
+{
+    struct MAX_cube cube;
+    int n;
+
+    n = MAXDiscoverAll(&cube, 1, NULL, tmo);
+    if (n > 0)
+    {
+        memcpy(sa, &cube.addr, sa_len < sizeof(cube.addr) ?
+               sa_len : sizeof(cube.addr));
+        memcpy(D_Data, &cube.D_Data, sizeof(*D_Data));
+    }
+
+    return n;
 }
 
 int MAXConnect(struct sockaddr *sa)
+{
+    return MAXConnectTmo(sa, -1);
+}
+
+int MAXConnectTmo(struct sockaddr *sa, int tmo)
 {
     int sockfd;
+    int flags;
+    socklen_t sa_len;
+    MAX_framer *framer;
+    uint64_t start = startMAXStat();
 
+    sa_len = (sa->sa_family == AF_INET6) ?
+        sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
     if((sockfd = socket(sa->sa_family, SOCK_STREAM, 0)) < 0)
     {
         return -1;
     }
 
-    if(connect(sockfd, sa, sizeof(*sa)) < 0)
+    /* Connect in non blocking mode so that an unreachable cube gives up
+     * after 'tmo' instead of the system SYN retry timeout */
+    flags = fcntl(sockfd, F_GETFL, 0);
+    if (tmo >= 0 && (flags < 0 ||
+                     fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    if(connect(sockfd, sa, sa_len) < 0)
+    {
+        struct pollfd pfd;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        int res;
+
+        if (tmo < 0 || errno != EINPROGRESS)
+        {
+            close(sockfd);
+            return -1;
+        }
+        pfd.fd = sockfd;
+        pfd.events = POLLOUT;
+        do {
+            res = poll(&pfd, 1, tmo);
+        } while (res < 0 && errno == EINTR);
+        if (res <= 0 ||
+            getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+            err != 0)
+        {
+            close(sockfd);
+            errno = (res == 0) ? ETIMEDOUT : (err != 0 ? err : errno);
+            return -1;
+        }
+    }
+
+    if (tmo >= 0 && fcntl(sockfd, F_SETFL, flags) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    /* Start with an empty reassembly buffer for the new session. The
+     * framer of a descriptor closed without MAXDisconnect may still hold
+     * bytes of the previous one. */
+    if ((framer = connMAXFramer(sockfd)) == NULL)
     {
+        close(sockfd);
         return -1;
     }
+    framer->start = framer->end = framer->scan = 0;
+    captureMAXData(MAXCapOpen, sockfd, NULL, 0);
+    endMAXStat(MAXStatConnect, start);
 
     return sockfd;
 }
 
 int MAXDisconnect(int connectionId)
 {
+    captureMAXData(MAXCapClose, connectionId, NULL, 0);
+    if (connectionId >= 0 && connectionId < FD_SETSIZE)
+    {
+        freeMAXFramer(conn_framer[connectionId]);
+        conn_framer[connectionId] = NULL;
+    }
     return close(connectionId);
 }
 
+int MAXKeepAlive(int connectionId, int idle)
+{
+    int on = 1;
+
+    if (setsockopt(connectionId, SOL_SOCKET, SO_KEEPALIVE, &on,
+                   sizeof(on)) < 0)
+    {
+        return -1;
+    }
+#ifdef TCP_KEEPIDLE
+    {
+        int intvl = 10, cnt = 3;
+
+        /* Not fatal, system defaults are used instead */
+        setsockopt(connectionId, IPPROTO_TCP, TCP_KEEPIDLE, &idle,
+                   sizeof(idle));
+        setsockopt(connectionId, IPPROTO_TCP, TCP_KEEPINTVL, &intvl,
+                   sizeof(intvl));
+        setsockopt(connectionId, IPPROTO_TCP, TCP_KEEPCNT, &cnt,
+                   sizeof(cnt));
+    }
+#endif
+    return 0;
+}
+
 int MAXMsgSend(int connectionId, MAX_msg_list *output_msg_list)
 {
-    int n, res;
-    char *p;
+    struct iovec iov[MAX_SEND_IOV];
+    struct pollfd pfd;
+    int cnt, i;
+    ssize_t res;
 
+    pfd.fd = connectionId;
+    pfd.events = POLLOUT;
     while (output_msg_list != NULL) {
-        p = (char *)output_msg_list->MAX_msg;
-        n = output_msg_list->MAX_msg_len;
-        while (n > 0)
+        /* Gather as many messages as possible in one call */
+        for (cnt = 0; cnt < MAX_SEND_IOV && output_msg_list != NULL; cnt++)
         {
-            res = write(connectionId, p, n);
+            iov[cnt].iov_base = output_msg_list->MAX_msg;
+            iov[cnt].iov_len = output_msg_list->MAX_msg_len;
+            output_msg_list = output_msg_list->next;
+        }
+        captureMAXData(MAXCapSend, connectionId, iov, cnt);
+        i = 0;
+        while (i < cnt)
+        {
+            res = writev(connectionId, &iov[i], cnt - i);
             if (res < 0)
             {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+                    poll(&pfd, 1, -1) >= 0)
+                {
+                    continue;
+                }
                 return -1;
             }
-            n -= res;
-            p += res;
+            /* Skip what was written, resume within a partial message */
+            while (i < cnt && (size_t)res >= iov[i].iov_len)
+            {
+                res -= iov[i].iov_len;
+                i++;
+            }
+            if (i < cnt)
+            {
+                iov[i].iov_base = (char*)iov[i].iov_base + res;
+                iov[i].iov_len -= res;
+            }
         }
-        output_msg_list = output_msg_list->next;
     }
     return 0;
 }
 
 int MaxMsgRecv(int connectionId, MAX_msg_list **input_msg_list)
 {
-    char recvBuff[4096];
-    int n;
+    MAX_framer *framer = connMAXFramer(connectionId);
+    uint64_t start = startMAXStat();
+    int n, count;
 
-    if ((n = read(connectionId, recvBuff, sizeof(recvBuff) - 1)) > 0)
+    if (framer == NULL)
     {
-        parseMAXData(recvBuff, n, input_msg_list);
+        return -1;
     }
 
+    /* Keep reading until at least one complete message is received */
+    do {
+        n = readMAXFramer(framer, connectionId, input_msg_list, &count);
+    } while (n > 0 && count == 0);
+    endMAXStat(MAXStatRecv, start);
+
     return 0;
 }
 
@@ -376,9 +885,15 @@ int MaxMsgRecvTmo(int connectionId, MAX_msg_list **input_msg_list, int tmo)
 #ifdef __CYGWIN__
     fd_set fds;
 #endif
-    char recvBuff[4096];
+    MAX_framer *framer = connMAXFramer(connectionId);
     struct timeval tv;
-    int n;
+    uint64_t start = startMAXStat();
+    int n, count;
+
+    if (framer == NULL)
+    {
+        return -1;
+    }
 
     tv.tv_sec = tmo / 1000;
     tv.tv_usec = (tmo % 1000) * 1000;
@@ -395,8 +910,7 @@ int MaxMsgRecvTmo(int connectionId, MAX_msg_list **input_msg_list, int tmo)
         }
         else if (n > 0)
         {
-            n = read(connectionId, recvBuff, sizeof(recvBuff) - 1);
-            parseMAXData(recvBuff, n, input_msg_list);
+            n = readMAXFramer(framer, connectionId, input_msg_list, &count);
         }
     } while (n > 0);
 #else
@@ -406,12 +920,86 @@ int MaxMsgRecvTmo(int connectionId, MAX_msg_list **input_msg_list, int tmo)
         return -1;
     }
 
-    while ((n = read(connectionId, recvBuff, sizeof(recvBuff) - 1)) > 0)
-    {
-        parseMAXData(recvBuff, n, input_msg_list);
-    }
+    while ((n = readMAXFramer(framer, connectionId, input_msg_list,
+                              &count)) > 0)
+        ;
 #endif
+    endMAXStat(MAXStatRecv, start);
 
     return 0;
 }
 
+static int waitMAXMsg(int connectionId, MAX_msg_list **input_msg_list,
+    int tmo, const char *types)
+{
+    MAX_framer *framer = connMAXFramer(connectionId);
+    struct timespec start, now;
+    struct pollfd pfd;
+    int n, count;
+
+    if (framer == NULL)
+    {
+        return -1;
+    }
+
+    /* Messages of other types must not extend the wait */
+    pfd.fd = connectionId;
+    pfd.events = POLLIN;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1)
+    {
+        MAX_msg_list *msg;
+        int left = -1;
+
+        if (tmo >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left = tmo - ((now.tv_sec - start.tv_sec) * 1000 +
+                          (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (left < 0)
+            {
+                return 0;
+            }
+        }
+        n = poll(&pfd, 1, left);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return n;
+        }
+        /* Remember where the new messages start */
+        msg = (*input_msg_list != NULL) ? (*input_msg_list)->last : NULL;
+        n = readMAXFramer(framer, connectionId, input_msg_list, &count);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        msg = (msg != NULL) ? msg->next : *input_msg_list;
+        for (; msg != NULL; msg = msg->next)
+        {
+            if (msg->MAX_msg->type != '\0' &&
+                strchr(types, msg->MAX_msg->type) != NULL)
+            {
+                return 1;
+            }
+        }
+    }
+}
+
+int MaxMsgRecvUntil(int connectionId, MAX_msg_list **input_msg_list, int tmo,
+    const char *types)
+{
+    uint64_t start = startMAXStat();
+    int res;
+
+    res = waitMAXMsg(connectionId, input_msg_list, tmo, types);
+    endMAXStat(MAXStatRecv, start);
+    return res;
+}
@@ -22,6 +22,8 @@
 #ifndef MAX_H
 #define MAX_H
 
+#include <sys/socket.h>
+
 #include "maxmsg.h"
 
 #define MSG_END "\r\n" /* Message terminator sequence */
@@ -33,15 +35,50 @@
 #define MAX_MCAST_ADDR "224.0.0.1"
 #define MAX_BCAST_ADDR "255.255.255.255"
 
+/* MAX_framer reassembles messages from a byte stream, keeping partial
+ * messages between reads. MAXConnect creates one for each connection. */
+typedef struct MAX_framer MAX_framer;
+
+/* A cube that answered a discovery */
+struct MAX_cube {
+    struct sockaddr_storage addr;
+    struct Discover_Data D_Data;
+};
+
 /* MAXDiscover retrieves the IP address of a cube in the LAN */
 /* Return value: negative if an error has occured, zero if no cube was found,
  * positive if a cube has been found */
 int MAXDiscover(struct sockaddr *sa, socklen_t sa_len,
     struct Discover_Data *D_Data, int tmo);
+/* MAXDiscoverAll retrieves every cube in the LAN answering within 'tmo' ms,
+ * at most 'max'. It returns early once 'max' cubes or the cube with serial
+ * number 'serial' (if not NULL) have answered. Return value: negative if an
+ * error has occured, otherwise the number of cubes found */
+int MAXDiscoverAll(struct MAX_cube *cubes, int max, const char *serial,
+    int tmo);
 int MAXConnect(struct sockaddr *sa);
+/* Same as MAXConnect but give up after 'tmo' ms, wait forever if negative */
+int MAXConnectTmo(struct sockaddr *sa, int tmo);
 int MAXDisconnect(int connectionId);
+/* Enable TCP keepalive on a connection, probing after 'idle' seconds without
+ * traffic, so that a silently dropped link is detected */
+int MAXKeepAlive(int connectionId, int idle);
 int MAXMsgSend(int connectionId, MAX_msg_list *output_msg_list);
 int MaxMsgRecv(int connectionId, MAX_msg_list **input_msg_list);
 int MaxMsgRecvTmo(int connectionId, MAX_msg_list **input_msg_list, int tmo);
+/* Receive until a message whose type is one of 'types' arrives, e.g. "L" for
+ * the end of the Hello burst or "S" for a command reply. 'tmo' (ms) bounds the
+ * whole wait, forever if negative. Return 1 if such a message was received, 0 on timeout,
+ * negative if an error has occured or the connection was closed. */
+int MaxMsgRecvUntil(int connectionId, MAX_msg_list **input_msg_list, int tmo,
+    const char *types);
+
+MAX_framer* createMAXFramer(void);
+void freeMAXFramer(MAX_framer *framer);
+/* Feed 'size' bytes of a stream to the framer and append every complete
+ * message to the list. Return the number of messages appended or negative if
+ * an error has occured */
+int feedMAXFramer(MAX_framer *framer, const char *data, size_t size,
+        MAX_msg_list **msg_list);
 
 #endif /* MAX_H */
@@ -0,0 +1,129 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdlib.h>
+
+#include "maxarena.h"
+
+/* Size of the first chunk, next chunks double in size up to
+ * MAX_ARENA_CHUNK_MAX */
+#define MAX_ARENA_CHUNK_SZ 4096
+#define MAX_ARENA_CHUNK_MAX (64 * 1024)
+/* Alignment of the returned blocks */
+#define MAX_ARENA_ALIGN 16
+
+#define ARENA_ROUND(x) (((x) + MAX_ARENA_ALIGN - 1) & ~(size_t)(MAX_ARENA_ALIGN - 1))
+
+struct MAX_arena_chunk {
+    struct MAX_arena_chunk *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+};
+
+struct MAX_arena {
+    struct MAX_arena_chunk *chunk; /* current chunk, head of chunk list */
+    size_t next_size;
+};
+
+#define CHUNK_HDR_SZ ARENA_ROUND(sizeof(struct MAX_arena_chunk))
+
+static struct MAX_arena_chunk* newMAXArenaChunk(size_t size)
+{
+    struct MAX_arena_chunk *chunk = malloc(CHUNK_HDR_SZ + size);
+
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+MAX_arena* createMAXArena(void)
+{
+    struct MAX_arena_chunk *chunk;
+    MAX_arena *arena;
+
+    /* The arena header lives in its own first chunk */
+    chunk = newMAXArenaChunk(MAX_ARENA_CHUNK_SZ);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    arena = (MAX_arena*)((char*)chunk + CHUNK_HDR_SZ);
+    chunk->used = ARENA_ROUND(sizeof(MAX_arena));
+    arena->chunk = chunk;
+    arena->next_size = MAX_ARENA_CHUNK_SZ * 2;
+    return arena;
+}
+
+void* allocMAXArena(MAX_arena *arena, size_t size)
+{
+    struct MAX_arena_chunk *chunk = arena->chunk;
+    void *ptr;
+
+    size = ARENA_ROUND(size);
+    if (chunk->size - chunk->used < size)
+    {
+        size_t chunk_sz = arena->next_size;
+
+        if (chunk_sz < size)
+        {
+            chunk_sz = size;
+        }
+        chunk = newMAXArenaChunk(chunk_sz);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        if (arena->next_size < MAX_ARENA_CHUNK_MAX)
+        {
+            arena->next_size *= 2;
+        }
+        /* Keep the first chunk, it holds the arena header, at the end of
+         * the list */
+        chunk->next = arena->chunk;
+        arena->chunk = chunk;
+    }
+    ptr = (char*)chunk + CHUNK_HDR_SZ + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void freeMAXArena(MAX_arena *arena)
+{
+    struct MAX_arena_chunk *chunk, *next;
+
+    if (arena == NULL)
+    {
+        return;
+    }
+    /* The arena header is released with the last chunk */
+    chunk = arena->chunk;
+    while (chunk != NULL)
+    {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
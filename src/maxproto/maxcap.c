@@ -0,0 +1,225 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "maxcap.h"
+
+/* Chunks of data gathered in one record, as many as MAXMsgSend writes */
+#define MAX_CAP_IOV 65
+
+/* Capture file shared by all the connections, -1 if not capturing. Forked
+ * processes append to the same file, each record is written at once. */
+static int cap_fd = -1;
+
+/* Return the end of the last complete record of the open capture file of
+ * 'size' bytes */
+static off_t endMAXCapture(int fd, off_t size)
+{
+    struct MAX_cap_record rec;
+    off_t pos = sizeof(struct MAX_cap_header);
+
+    while (pos + (off_t)sizeof(rec) <= size)
+    {
+        if (pread(fd, &rec, sizeof(rec), pos) != sizeof(rec))
+        {
+            return -1;
+        }
+        if (pos + (off_t)sizeof(rec) + rec.len > size)
+        {
+            break;
+        }
+        pos += sizeof(rec) + rec.len;
+    }
+    return pos;
+}
+
+int openMAXCapture(const char *path)
+{
+    struct MAX_cap_header header;
+    struct stat st;
+    off_t end;
+    int fd;
+
+    closeMAXCapture();
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        goto error;
+    }
+    if (st.st_size == 0)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAX_CAP_MAGIC, sizeof(header.magic));
+        header.version = MAX_CAP_VERSION;
+        header.byte_order = MAX_CAP_BYTE_ORDER;
+        header.created = time(NULL);
+        if (write(fd, &header, sizeof(header)) != sizeof(header))
+        {
+            goto error;
+        }
+        cap_fd = fd;
+        return 0;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, MAX_CAP_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MAX_CAP_VERSION ||
+        header.byte_order != MAX_CAP_BYTE_ORDER)
+    {
+        errno = EINVAL;
+        goto error;
+    }
+    /* Appended records must start on a record boundary */
+    end = endMAXCapture(fd, st.st_size);
+    if (end < 0 || (end != st.st_size && ftruncate(fd, end) < 0))
+    {
+        goto error;
+    }
+    cap_fd = fd;
+    return 0;
+
+error:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return -1;
+}
+
+void closeMAXCapture(void)
+{
+    if (cap_fd >= 0)
+    {
+        close(cap_fd);
+        cap_fd = -1;
+    }
+}
+
+void captureMAXData(int dir, int connectionId, const struct iovec *iov,
+    int cnt)
+{
+    struct iovec rec_iov[MAX_CAP_IOV];
+    struct MAX_cap_record rec;
+    struct timespec ts;
+    int i;
+
+    if (cap_fd < 0)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(&rec, 0, sizeof(rec));
+    rec.time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec.stream = ((uint32_t)getpid() << 10) | (connectionId & 0x3ff);
+    rec.dir = dir;
+    rec_iov[0].iov_base = &rec;
+    rec_iov[0].iov_len = sizeof(rec);
+    for (i = 0; i < cnt && i < MAX_CAP_IOV - 1; i++)
+    {
+        rec_iov[i + 1] = iov[i];
+        rec.len += iov[i].iov_len;
+    }
+    /* A failed capture must not break the session */
+    if (writev(cap_fd, rec_iov, i + 1) < 0)
+    {
+        closeMAXCapture();
+    }
+}
+
+int mapMAXCapture(const char *path, MAX_cap_map *map)
+{
+    const struct MAX_cap_header *header;
+    struct stat st;
+    int fd;
+
+    memset(map, 0, sizeof(*map));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct MAX_cap_header))
+    {
+        close(fd);
+        return -1;
+    }
+    map->len = st.st_size;
+    map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->addr == MAP_FAILED)
+    {
+        map->addr = NULL;
+        return -1;
+    }
+
+    header = map->header = map->addr;
+    if (memcmp(header->magic, MAX_CAP_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != MAX_CAP_VERSION ||
+        header->byte_order != MAX_CAP_BYTE_ORDER)
+    {
+        unmapMAXCapture(map);
+        return -1;
+    }
+    map->data = (const uint8_t*)(header + 1);
+    map->size = map->len - sizeof(struct MAX_cap_header);
+    /* Records are read in sequence */
+    madvise(map->addr, map->len, MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+void unmapMAXCapture(MAX_cap_map *map)
+{
+    if (map->addr != NULL)
+    {
+        munmap(map->addr, map->len);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+int nextMAXCapture(const MAX_cap_map *map, size_t *offset,
+    struct MAX_cap_record *rec, const char **data)
+{
+    if (*offset >= map->size)
+    {
+        return 0;
+    }
+    if (map->size - *offset < sizeof(*rec))
+    {
+        return -1;
+    }
+    /* Records are not aligned, the data length is arbitrary */
+    memcpy(rec, map->data + *offset, sizeof(*rec));
+    if (map->size - *offset - sizeof(*rec) < rec->len)
+    {
+        return -1;
+    }
+    *data = (const char*)map->data + *offset + sizeof(*rec);
+    *offset += sizeof(*rec) + rec->len;
+    return 1;
+}
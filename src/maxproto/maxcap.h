@@ -0,0 +1,96 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#ifndef MAXCAP_H
+#define MAXCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Session capture
+ * ==========================================
+ * A capture file is a MAX_cap_header followed by one record per chunk of
+ * bytes read from or written to a cube connection: a MAX_cap_record and its
+ * 'len' bytes of data, as they went through the socket. Records of every
+ * connection are appended in time order, 'stream' tells the connections
+ * apart. A stream starts with a MAXCapOpen record and ends with MAXCapClose,
+ * both without data. Numbers are in host byte order, the header tells which
+ * one. */
+#define MAX_CAP_MAGIC "MAXCAP"
+#define MAX_CAP_VERSION 1
+#define MAX_CAP_BYTE_ORDER 0x01020304
+
+struct MAX_cap_header {
+    char     magic[6];      /* MAX_CAP_MAGIC, not terminated */
+    uint8_t  version;
+    uint8_t  reserved;
+    uint32_t byte_order;    /* MAX_CAP_BYTE_ORDER as written by the host */
+    int64_t  created;       /* seconds since the epoch */
+};
+
+enum MAXCapDir
+{
+    MAXCapRecv = 'r',
+    MAXCapSend = 's',
+    MAXCapOpen = 'o',
+    MAXCapClose = 'c'
+};
+
+struct MAX_cap_record {
+    uint64_t time;          /* CLOCK_MONOTONIC in ns */
+    uint32_t stream;        /* process and descriptor of the connection */
+    uint32_t len;           /* bytes of data following the record */
+    uint8_t  dir;           /* enum MAXCapDir */
+    uint8_t  reserved[7];
+};
+
+/* Capture the traffic of every connection to 'path', appending to it if it
+ * is already a capture file. A partial record left by an interrupted write
+ * is dropped. Return negative if the file cannot be opened. */
+int openMAXCapture(const char *path);
+void closeMAXCapture(void);
+/* Append a record with the data in 'iov' to the capture file, nothing is
+ * done if no capture is open. Used by the connection functions of max.c. */
+void captureMAXData(int dir, int connectionId, const struct iovec *iov,
+    int cnt);
+
+/* MAX_cap_map is a capture file mapped in memory for reading */
+typedef struct MAX_cap_map {
+    const struct MAX_cap_header *header;
+    const uint8_t *data;    /* records, after the header */
+    size_t size;
+    void *addr;
+    size_t len;
+} MAX_cap_map;
+
+/* Map a capture file. Return negative if it cannot be mapped or was written
+ * by a host with another byte order. */
+int mapMAXCapture(const char *path, MAX_cap_map *map);
+void unmapMAXCapture(MAX_cap_map *map);
+/* Read the record at byte '*offset' of the mapped records into 'rec' and
+ * point 'data' to its data, then move '*offset' to the next record. Return 1
+ * if a record was read, 0 at the end and negative if the record is
+ * truncated. */
+int nextMAXCapture(const MAX_cap_map *map, size_t *offset,
+    struct MAX_cap_record *rec, const char **data);
+
+#endif /* MAXCAP_H */
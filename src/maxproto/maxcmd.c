@@ -0,0 +1,466 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "maxmsg.h"
+#include "max.h"
+#include "base64.h"
+#include "maxcmd.h"
+#include "maxstats.h"
+
+/* Size of the largest 's' message, program data being the longest payload */
+#define MAX_CMD_MSG_SZ (sizeof(struct MAX_message) - 1 + \
+        BASE64_ENCODED_SZ(sizeof(struct s_Program_Data)) + MSG_END_LEN)
+
+/* Initial number of queue slots */
+#define MAX_CMD_QUEUE_SZ 16
+
+/* The cube may use 1% of the air time, the budget is counted over one hour.
+ * The reported duty cycle (0 to 100% of the budget) falls by about 1% every
+ * 36 s when the radio is idle. Commands are deferred when the estimate would
+ * go above MAX_CMD_DUTY_MAX. */
+#ifndef MAX_CMD_DUTY_DECAY_MS
+#define MAX_CMD_DUTY_DECAY_MS 36000
+#endif
+#define MAX_CMD_DUTY_MAX 90
+/* Initial guesses for the duty cycle used by one command (%) and for the
+ * reply time (ms), refined with every reply */
+#define MAX_CMD_COST_INIT 1.0
+#define MAX_CMD_RTT_INIT 100.0
+/* Weight of a new sample in the moving averages */
+#define MAX_CMD_EWMA 0.25
+/* Wait before sending anyway when the cube reports no free memory slots */
+#define MAX_CMD_SLOT_WAIT_MS 10000
+
+/* struct MAX_cmd_slot - copy of a queued command */
+struct MAX_cmd_slot {
+    int tries;      /* times sent */
+    long long sent; /* send time (ms) of the last try */
+    uint64_t stat_start; /* latency probe of the last try */
+    size_t len;
+    char msg[MAX_CMD_MSG_SZ];
+};
+
+/* struct MAX_cmdq - commands in submission order, rejected commands are
+ * appended again. cmd[0..acked) are done, cmd[acked..sent) are in flight.
+ * Received messages are kept in 'rx' until all of them are consumed,
+ * 'rx_done' is the last one consumed. */
+struct MAX_cmdq {
+    int connectionId;
+    int window;
+    int tmo;
+    struct MAX_cmd_slot *cmd;
+    int size;
+    int count;
+    int acked;
+    int sent;
+    int rejected;
+    int error;
+    /* Radio budget as last reported by the cube, -1 if unknown */
+    int duty;
+    int free_slots;
+    long long duty_time;
+    double cost;
+    double rtt;
+    MAX_msg_list *rx;
+    MAX_msg_list *rx_done;
+    MAX_cmd_cb cb;
+    void *arg;
+};
+
+static long long nowMAXms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Parse 'len' hex digits */
+static int hexMAXField(const char *s, int len)
+{
+    char buf[8];
+
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return (int)strtol(buf, NULL, 16);
+}
+
+MAX_cmdq* createMAXCmdQueue(int connectionId, int window, int tmo)
+{
+    MAX_cmdq *cmdq;
+
+    if (window < 1 || window > MAX_CMD_WINDOW_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    cmdq = calloc(1, sizeof(*cmdq));
+    if (cmdq == NULL)
+    {
+        return NULL;
+    }
+    cmdq->connectionId = connectionId;
+    cmdq->window = window;
+    cmdq->tmo = tmo;
+    cmdq->duty = -1;
+    cmdq->free_slots = -1;
+    cmdq->cost = MAX_CMD_COST_INIT;
+    cmdq->rtt = MAX_CMD_RTT_INIT;
+    return cmdq;
+}
+
+void freeMAXCmdQueue(MAX_cmdq *cmdq)
+{
+    if (cmdq == NULL)
+    {
+        return;
+    }
+    freeMAXpkt(&cmdq->rx);
+    free(cmdq->cmd);
+    free(cmdq);
+}
+
+void setMAXCmdCallback(MAX_cmdq *cmdq, MAX_cmd_cb cb, void *arg)
+{
+    cmdq->cb = cb;
+    cmdq->arg = arg;
+}
+
+/* Duty cycle estimate at 'now', 0 if unknown */
+static double estMAXDuty(MAX_cmdq *cmdq, long long now)
+{
+    double duty;
+
+    if (cmdq->duty < 0)
+    {
+        return 0;
+    }
+    duty = cmdq->duty - (double)(now - cmdq->duty_time) /
+           MAX_CMD_DUTY_DECAY_MS;
+    return (duty > 0) ? duty : 0;
+}
+
+int dutyMAXCmdQueue(MAX_cmdq *cmdq)
+{
+    if (cmdq->duty < 0)
+    {
+        return -1;
+    }
+    return (int)(estMAXDuty(cmdq, nowMAXms()) + 0.5);
+}
+
+/* Record the radio budget reported by the cube. 'acked' is set for an 'S'
+ * reply, the increase since the previous report is then the cost of the
+ * command. */
+static void setMAXDuty(MAX_cmdq *cmdq, int duty, int free_slots, int acked)
+{
+    long long now = nowMAXms();
+
+    if (acked && cmdq->duty >= 0)
+    {
+        double cost = duty - estMAXDuty(cmdq, now);
+
+        if (cost < 0)
+        {
+            cost = 0;
+        }
+        cmdq->cost += MAX_CMD_EWMA * (cost - cmdq->cost);
+    }
+    cmdq->duty = duty;
+    cmdq->free_slots = free_slots;
+    cmdq->duty_time = now;
+}
+
+void updateMAXCmdQueue(MAX_cmdq *cmdq, MAX_msg_list *msg_list)
+{
+    while (msg_list != NULL)
+    {
+        if (msg_list->MAX_msg->type == 'H')
+        {
+            struct H_Data *H_D = (struct H_Data*)msg_list->MAX_msg->data;
+
+            setMAXDuty(cmdq, hexMAXField(H_D->Duty_cycle,
+                                         sizeof(H_D->Duty_cycle)),
+                       hexMAXField(H_D->Free_Memory_Slots,
+                                   sizeof(H_D->Free_Memory_Slots)), 0);
+        }
+        else if (msg_list->MAX_msg->type == 'S')
+        {
+            struct S_Data *S_D = (struct S_Data*)msg_list->MAX_msg->data;
+
+            setMAXDuty(cmdq, hexMAXField(S_D->Duty_Cycle,
+                                         sizeof(S_D->Duty_Cycle)),
+                       hexMAXField(S_D->Free_Memory_Slots,
+                                   sizeof(S_D->Free_Memory_Slots)), 0);
+        }
+        msg_list = msg_list->next;
+    }
+}
+
+/* Append a command to the queue, growing it if needed */
+static int addMAXCmd(MAX_cmdq *cmdq, const char *msg, size_t len, int tries)
+{
+    struct MAX_cmd_slot *slot;
+
+    if (len > MAX_CMD_MSG_SZ)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (cmdq->count == cmdq->size)
+    {
+        int size = cmdq->size ? cmdq->size * 2 : MAX_CMD_QUEUE_SZ;
+
+        slot = realloc(cmdq->cmd, size * sizeof(*slot));
+        if (slot == NULL)
+        {
+            return -1;
+        }
+        cmdq->cmd = slot;
+        cmdq->size = size;
+    }
+    slot = &cmdq->cmd[cmdq->count++];
+    memcpy(slot->msg, msg, len);
+    slot->len = len;
+    slot->tries = tries;
+    slot->sent = 0;
+    return 0;
+}
+
+int submitMAXCmd(MAX_cmdq *cmdq, MAX_msg_list *msg)
+{
+    return addMAXCmd(cmdq, (const char*)msg->MAX_msg, msg->MAX_msg_len, 0);
+}
+
+/* Return the next 'S' message received and not consumed yet, NULL if there
+ * is none. Other messages are skipped. */
+static MAX_msg_list* nextMAXReply(MAX_cmdq *cmdq)
+{
+    MAX_msg_list *msg;
+
+    if (cmdq->rx != NULL && cmdq->rx_done == cmdq->rx->last)
+    {
+        /* Everything received has been consumed */
+        freeMAXpkt(&cmdq->rx);
+        cmdq->rx_done = NULL;
+    }
+    msg = (cmdq->rx_done != NULL) ? cmdq->rx_done->next : cmdq->rx;
+    while (msg != NULL)
+    {
+        cmdq->rx_done = msg;
+        if (msg->MAX_msg->type == 'S')
+        {
+            return msg;
+        }
+        msg = msg->next;
+    }
+    return NULL;
+}
+
+/* Send the next 'n' queued commands at once */
+static int sendMAXCmds(MAX_cmdq *cmdq, int n)
+{
+    MAX_msg_list batch[MAX_CMD_WINDOW_MAX], *msg_list = NULL;
+    long long now;
+    uint64_t start;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct MAX_cmd_slot *slot = &cmdq->cmd[cmdq->sent + i];
+
+        msg_list = linkMAXmsg(msg_list, &batch[i],
+                              (struct MAX_message*)slot->msg, slot->len);
+    }
+    if (MAXMsgSend(cmdq->connectionId, msg_list) != 0)
+    {
+        cmdq->error = -1;
+        return -1;
+    }
+    now = nowMAXms();
+    start = startMAXStat();
+    for (i = 0; i < n; i++)
+    {
+        cmdq->cmd[cmdq->sent].tries++;
+        cmdq->cmd[cmdq->sent].sent = now;
+        cmdq->cmd[cmdq->sent].stat_start = start;
+        cmdq->sent++;
+    }
+    return 0;
+}
+
+/* Wait for the reply of the oldest command in flight */
+static int ackMAXCmd(MAX_cmdq *cmdq)
+{
+    struct MAX_cmd_slot *slot;
+    MAX_msg_list *reply, cmd, rsp;
+    struct S_Data *S_D;
+    int retry = 0;
+
+    while ((reply = nextMAXReply(cmdq)) == NULL)
+    {
+        if (MaxMsgRecvUntil(cmdq->connectionId, &cmdq->rx, cmdq->tmo,
+                            "S") <= 0)
+        {
+            cmdq->error = -1;
+            return -1;
+        }
+    }
+    /* The queue may move when a command is added again */
+    slot = &cmdq->cmd[cmdq->acked];
+    cmdq->rtt += MAX_CMD_EWMA * ((nowMAXms() - slot->sent) - cmdq->rtt);
+    endMAXStat(MAXStatCmd, slot->stat_start);
+
+    S_D = (struct S_Data*)reply->MAX_msg->data;
+    setMAXDuty(cmdq, hexMAXField(S_D->Duty_Cycle, sizeof(S_D->Duty_Cycle)),
+               hexMAXField(S_D->Free_Memory_Slots,
+                           sizeof(S_D->Free_Memory_Slots)), 1);
+    if (S_D->Command_Result[0] != '0')
+    {
+        /* Out of budget, make sure the retry waits for it to recover */
+        if (cmdq->duty < MAX_CMD_DUTY_MAX)
+        {
+            cmdq->duty = MAX_CMD_DUTY_MAX;
+        }
+        if (slot->tries < MAX_CMD_TRIES &&
+            addMAXCmd(cmdq, slot->msg, slot->len, slot->tries) == 0)
+        {
+            retry = 1;
+            slot = &cmdq->cmd[cmdq->acked];
+        }
+        else
+        {
+            cmdq->rejected++;
+        }
+    }
+    if (cmdq->cb != NULL)
+    {
+        /* Hand out single elements, not the rest of the lists */
+        cmdq->cb(cmdq->arg,
+                 linkMAXmsg(NULL, &cmd, (struct MAX_message*)slot->msg,
+                            slot->len),
+                 linkMAXmsg(NULL, &rsp, reply->MAX_msg, reply->MAX_msg_len),
+                 retry);
+    }
+    cmdq->acked++;
+    return 0;
+}
+
+/* Return 0 if one more command can be sent now with 'in_flight' commands
+ * in flight, otherwise the time to wait for (ms) when no reply is expected
+ * that could change the decision, or -1 to wait for the next reply */
+static long holdMAXCmd(MAX_cmdq *cmdq, int in_flight)
+{
+    double duty, excess;
+
+    if (in_flight >= cmdq->window)
+    {
+        return -1;
+    }
+    if (cmdq->free_slots >= 0 && in_flight >= cmdq->free_slots)
+    {
+        return (in_flight > 0) ? -1 : MAX_CMD_SLOT_WAIT_MS;
+    }
+    if (cmdq->duty < 0)
+    {
+        /* Unknown budget, e.g. no H message seen: the 'S' reply of a single
+         * command tells the duty cycle before the window opens */
+        return (in_flight > 0) ? -1 : 0;
+    }
+    duty = estMAXDuty(cmdq, nowMAXms());
+    excess = duty + cmdq->cost * (in_flight + 1) - MAX_CMD_DUTY_MAX;
+    if (excess <= 0 || (duty == 0 && in_flight == 0))
+    {
+        /* A command that alone exceeds the budget cannot wait for it */
+        return 0;
+    }
+    if (in_flight > 0)
+    {
+        return -1;
+    }
+    return (long)(excess * MAX_CMD_DUTY_DECAY_MS) + 1;
+}
+
+long estimateMAXCmdQueue(MAX_cmdq *cmdq)
+{
+    int n = cmdq->count - cmdq->acked;
+    double t, excess;
+
+    t = n * cmdq->rtt / cmdq->window;
+    excess = estMAXDuty(cmdq, nowMAXms()) + n * cmdq->cost -
+             MAX_CMD_DUTY_MAX;
+    if (excess > 0)
+    {
+        t += excess * MAX_CMD_DUTY_DECAY_MS;
+    }
+    return (long)t;
+}
+
+int flushMAXCmdQueue(MAX_cmdq *cmdq)
+{
+    while (cmdq->error == 0 && cmdq->acked < cmdq->count)
+    {
+        int in_flight = cmdq->sent - cmdq->acked;
+        long wait = (cmdq->sent < cmdq->count) ?
+            holdMAXCmd(cmdq, in_flight) : -1;
+
+        if (wait == 0)
+        {
+            int n = 0;
+
+            /* Take every command that can go now and send them together */
+            do {
+                n++;
+            } while (cmdq->sent + n < cmdq->count &&
+                     holdMAXCmd(cmdq, in_flight + n) == 0);
+            if (sendMAXCmds(cmdq, n) < 0)
+            {
+                /* Broken connection, the batch was not marked in flight */
+                return cmdq->error;
+            }
+        }
+        else if (wait < 0 || cmdq->sent > cmdq->acked)
+        {
+            if (ackMAXCmd(cmdq) < 0)
+            {
+                return cmdq->error;
+            }
+        }
+        else
+        {
+            /* Nothing in flight, let the radio budget recover */
+            poll(NULL, 0, (wait > MAX_CMD_SLOT_WAIT_MS) ?
+                 MAX_CMD_SLOT_WAIT_MS : (int)wait);
+            if (cmdq->free_slots == 0)
+            {
+                /* Cannot be refreshed without sending, try anyway */
+                cmdq->free_slots = -1;
+            }
+        }
+    }
+    return cmdq->error ? cmdq->error : cmdq->rejected;
+}
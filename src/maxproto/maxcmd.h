@@ -0,0 +1,70 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#ifndef MAXCMD_H
+#define MAXCMD_H
+
+#include "maxmsg.h"
+
+/* Default and largest number of 's' commands in flight */
+#define MAX_CMD_WINDOW 4
+#define MAX_CMD_WINDOW_MAX 32
+
+/* Times a command rejected by the cube is sent before giving up */
+#define MAX_CMD_TRIES 3
+
+/* MAX_cmdq schedules 's' commands on a connection. Commands are queued first,
+ * then sent without waiting for the 'S' reply of each one: up to 'window'
+ * commands are in flight and the cube answers them in order, so replies are
+ * matched to commands first in, first out.
+ * The duty cycle and free memory slots reported in H and S messages are
+ * tracked so that commands are deferred before the cube runs out of radio
+ * budget. Rejected commands are queued again, up to MAX_CMD_TRIES times. */
+typedef struct MAX_cmdq MAX_cmdq;
+
+/* Called for every reply with the command as sent and the 'S' message, both
+ * single elements. 'retry' is non zero if the command was rejected and will be
+ * sent again. */
+typedef void (*MAX_cmd_cb)(void *arg, MAX_msg_list *cmd, MAX_msg_list *reply,
+    int retry);
+
+/* Create a queue on an open connection. 'tmo' (ms) bounds the wait for a
+ * reply. Return NULL if out of memory or 'window' is not valid. */
+MAX_cmdq* createMAXCmdQueue(int connectionId, int window, int tmo);
+/* Free the queue, commands still queued are dropped */
+void freeMAXCmdQueue(MAX_cmdq *cmdq);
+void setMAXCmdCallback(MAX_cmdq *cmdq, MAX_cmd_cb cb, void *arg);
+/* Take the duty cycle and free memory slots from the H and S messages of a
+ * packet, e.g. the Hello burst */
+void updateMAXCmdQueue(MAX_cmdq *cmdq, MAX_msg_list *msg_list);
+/* Queue a copy of the 's' command 'msg'. Return negative if an error has
+ * occured. */
+int submitMAXCmd(MAX_cmdq *cmdq, MAX_msg_list *msg);
+/* Estimated time in ms until all the queued commands are acknowledged */
+long estimateMAXCmdQueue(MAX_cmdq *cmdq);
+/* Send the queued commands and wait for all the replies. Return the number of
+ * commands finally rejected by the cube, negative if an error has occured */
+int flushMAXCmdQueue(MAX_cmdq *cmdq);
+/* Duty cycle in % of the radio budget, as last reported by the cube and
+ * decayed since then, -1 if not reported yet */
+int dutyMAXCmdQueue(MAX_cmdq *cmdq);
+
+#endif /* MAXCMD_H */
@@ -0,0 +1,718 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "maxlog.h"
+
+/* Records kept before they are written, a sample normally fits */
+#define MAX_LOG_BUF 128
+
+/* Largest delta log frame: tag, length, time, count and at most 20 bytes
+ * per device */
+#define MAX_LOG_FRAME_MAX (16 + MAX_LOG_DEVICES * 20)
+/* Room left in front of a frame payload for its tag and length */
+#define MAX_LOG_FRAME_HDR 6
+
+struct MAX_log_writer {
+    int fd;
+    int format;
+    off_t end;             /* end of the last complete record or frame */
+    /* Fixed format */
+    uint64_t count;        /* records in the file and in the buffer */
+    int used;
+    struct MAX_log_record buf[MAX_LOG_BUF];
+    /* Delta format, previous sample */
+    uint32_t time;
+    int prev_count;        /* negative if the next frame must be a key */
+    int since_key;         /* samples since the last key frame */
+    struct MAX_device_state prev[MAX_LOG_DEVICES];
+    uint8_t frame[MAX_LOG_FRAME_MAX];
+};
+
+static uint8_t* putMAXVarint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/* Return negative if the varint is truncated or longer than 32 bits */
+static int getMAXVarint(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+    const uint8_t *q = *p;
+    int shift;
+
+    *v = 0;
+    for (shift = 0; shift < 35 && q < end; shift += 7)
+    {
+        *v |= (uint32_t)(*q & 0x7f) << shift;
+        if ((*q++ & 0x80) == 0)
+        {
+            *p = q;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Small signed values, positive or negative, give small varints */
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static int writeMAXLogData(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Drop what a failed write left after the last complete record or frame, so
+ * that the next one is appended where it belongs. Buffered records are lost
+ * and the record count follows the file again. */
+static void rewindMAXLog(MAX_log_writer *log)
+{
+    ftruncate(log->fd, log->end);
+    lseek(log->fd, log->end, SEEK_SET);
+    log->used = 0;
+    if (log->format == MAXLogFixed)
+    {
+        log->count = (log->end - sizeof(struct MAX_log_header)) /
+            sizeof(struct MAX_log_record);
+    }
+}
+
+static int writeMAXLogBuf(MAX_log_writer *log)
+{
+    size_t len = log->used * sizeof(log->buf[0]);
+
+    if (writeMAXLogData(log->fd, log->buf, len) < 0)
+    {
+        rewindMAXLog(log);
+        return -1;
+    }
+    log->end += len;
+    log->used = 0;
+
+    return 0;
+}
+
+/* Return the size of the complete frames of a delta log, 'size' bytes long,
+ * after the header */
+static off_t endMAXLogFrames(int fd, off_t size)
+{
+    const uint8_t *addr, *p, *end;
+    off_t valid;
+
+    addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        return -1;
+    }
+    p = addr + sizeof(struct MAX_log_header);
+    end = addr + size;
+    while (p < end)
+    {
+        const uint8_t *q = p + 1;
+        uint32_t len;
+
+        if ((*p != MAX_LOG_TAG_KEY && *p != MAX_LOG_TAG_DELTA) ||
+            getMAXVarint(&q, end, &len) < 0 || len > end - q)
+        {
+            break;
+        }
+        p = q + len;
+    }
+    valid = p - addr;
+    munmap((void*)addr, size);
+
+    return valid;
+}
+
+MAX_log_writer* openMAXLog(const char *path, enum MAXLogFormat format)
+{
+    MAX_log_writer *log;
+    struct MAX_log_header header;
+    struct stat st;
+    off_t end;
+
+    if (format != MAXLogFixed && format != MAXLogDelta)
+    {
+        return NULL;
+    }
+    log = malloc(sizeof(*log));
+    if (log == NULL)
+    {
+        return NULL;
+    }
+    log->format = format;
+    log->count = 0;
+    log->used = 0;
+    log->prev_count = -1;
+    log->since_key = 0;
+    log->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (log->fd < 0 || fstat(log->fd, &st) < 0)
+    {
+        goto error;
+    }
+
+    if (st.st_size == 0)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAX_LOG_MAGIC, sizeof(header.magic));
+        header.format = format;
+        header.record_size = (format == MAXLogFixed) ?
+            sizeof(struct MAX_log_record) : 0;
+        header.byte_order = MAX_LOG_BYTE_ORDER;
+        header.created = time(NULL);
+        if (write(log->fd, &header, sizeof(header)) != sizeof(header))
+        {
+            goto error;
+        }
+        log->end = sizeof(header);
+        return log;
+    }
+
+    if (read(log->fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, MAX_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+        header.format != format ||
+        header.record_size != ((format == MAXLogFixed) ?
+                               sizeof(struct MAX_log_record) : 0) ||
+        header.byte_order != MAX_LOG_BYTE_ORDER)
+    {
+        goto error;
+    }
+    /* Drop a partial record or frame, appended data must stay aligned */
+    if (format == MAXLogFixed)
+    {
+        log->count = (st.st_size - sizeof(header)) /
+            sizeof(struct MAX_log_record);
+        end = sizeof(header) + log->count * sizeof(struct MAX_log_record);
+    }
+    else
+    {
+        end = endMAXLogFrames(log->fd, st.st_size);
+    }
+    if (end < 0 || (end != st.st_size && ftruncate(log->fd, end) < 0))
+    {
+        goto error;
+    }
+    if (lseek(log->fd, end, SEEK_SET) < 0)
+    {
+        goto error;
+    }
+    log->end = end;
+
+    return log;
+
+error:
+    if (log->fd >= 0)
+    {
+        close(log->fd);
+    }
+    free(log);
+    return NULL;
+}
+
+static int appendMAXLogFixed(MAX_log_writer *log, uint32_t time,
+    const struct MAX_device_state *state, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        struct MAX_log_record *rec;
+
+        if (log->used + 2 > MAX_LOG_BUF && writeMAXLogBuf(log) < 0)
+        {
+            return -1;
+        }
+        if (log->count % MAX_LOG_SYNC_EVERY == 0)
+        {
+            rec = &log->buf[log->used++];
+            memset(rec, 0, sizeof(*rec));
+            rec->time = time;
+            rec->rf_address = MAX_LOG_SYNC_ADDR;
+            rec->flags = MAX_LOG_SYNC_FLAGS;
+            log->count++;
+        }
+        rec = &log->buf[log->used++];
+        rec->time = time;
+        rec->rf_address = state[i].rf_address;
+        rec->valve = state[i].valve;
+        rec->setpoint = state[i].setpoint;
+        rec->actual = state[i].actual;
+        rec->mode = state[i].mode;
+        rec->rec_flags = (state[i].battery_low ? MAX_LOG_REC_BATTERY : 0) |
+            (i == 0 ? MAX_LOG_REC_FIRST : 0);
+        rec->flags = state[i].flags;
+        log->count++;
+    }
+
+    return writeMAXLogBuf(log);
+}
+
+static int appendMAXLogDelta(MAX_log_writer *log, uint32_t time,
+    const struct MAX_device_state *state, int count)
+{
+    uint8_t *payload = log->frame + MAX_LOG_FRAME_HDR;
+    uint8_t *p = payload, *hdr;
+    uint8_t tmp[MAX_LOG_FRAME_HDR];
+    int key, i, n;
+
+    /* Deltas need the same devices in the same order */
+    key = (log->prev_count != count || log->since_key >= MAX_LOG_KEY_EVERY ||
+           time < log->time);
+    for (i = 0; !key && i < count; i++)
+    {
+        key = (state[i].rf_address != log->prev[i].rf_address);
+    }
+
+    if (key)
+    {
+        p = putMAXVarint(p, time);
+        p = putMAXVarint(p, count);
+        for (i = 0; i < count; i++)
+        {
+            const struct MAX_device_state *st = &state[i];
+
+            p = putMAXVarint(p, st->rf_address);
+            p = putMAXVarint(p, st->valve);
+            p = putMAXVarint(p, st->setpoint);
+            p = putMAXVarint(p, zigzag(st->actual));
+            p = putMAXVarint(p, st->mode);
+            p = putMAXVarint(p, st->battery_low ? MAX_LOG_REC_BATTERY : 0);
+            p = putMAXVarint(p, st->flags);
+        }
+        log->since_key = 0;
+    }
+    else
+    {
+        p = putMAXVarint(p, time - log->time);
+        p = putMAXVarint(p, count);
+        for (i = 0; i < count; i++)
+        {
+            const struct MAX_device_state *st = &state[i];
+            const struct MAX_device_state *old = &log->prev[i];
+            uint8_t *mask = p++;
+
+            *mask = 0;
+            if (st->valve != old->valve)
+            {
+                *mask |= MAX_LOG_CHG_VALVE;
+                p = putMAXVarint(p, zigzag(st->valve - old->valve));
+            }
+            if (st->setpoint != old->setpoint)
+            {
+                *mask |= MAX_LOG_CHG_SETPOINT;
+                p = putMAXVarint(p, zigzag(st->setpoint - old->setpoint));
+            }
+            if (st->actual != old->actual)
+            {
+                *mask |= MAX_LOG_CHG_ACTUAL;
+                p = putMAXVarint(p, zigzag(st->actual - old->actual));
+            }
+            if (st->mode != old->mode)
+            {
+                *mask |= MAX_LOG_CHG_MODE;
+                p = putMAXVarint(p, st->mode);
+            }
+            if (!st->battery_low != !old->battery_low)
+            {
+                *mask |= MAX_LOG_CHG_REC;
+                p = putMAXVarint(p, st->battery_low ? MAX_LOG_REC_BATTERY : 0);
+            }
+            if (st->flags != old->flags)
+            {
+                *mask |= MAX_LOG_CHG_FLAGS;
+                p = putMAXVarint(p, st->flags);
+            }
+        }
+    }
+
+    /* Tag and length go right in front of the payload */
+    tmp[0] = key ? MAX_LOG_TAG_KEY : MAX_LOG_TAG_DELTA;
+    n = putMAXVarint(tmp + 1, p - payload) - tmp;
+    hdr = payload - n;
+    memcpy(hdr, tmp, n);
+
+    if (writeMAXLogData(log->fd, hdr, p - hdr) < 0)
+    {
+        /* Drop the partial frame and restart with a key */
+        rewindMAXLog(log);
+        log->prev_count = -1;
+        return -1;
+    }
+    log->end += p - hdr;
+    memcpy(log->prev, state, count * sizeof(*state));
+    log->prev_count = count;
+    log->time = time;
+    log->since_key++;
+
+    return 0;
+}
+
+int appendMAXLog(MAX_log_writer *log, uint32_t time,
+    const struct MAX_device_state *state, int count)
+{
+    if (count > MAX_LOG_DEVICES)
+    {
+        /* The decoder could not read it back */
+        return -1;
+    }
+    if (log->format == MAXLogDelta)
+    {
+        return appendMAXLogDelta(log, time, state, count);
+    }
+    return appendMAXLogFixed(log, time, state, count);
+}
+
+void closeMAXLog(MAX_log_writer *log)
+{
+    if (log == NULL)
+    {
+        return;
+    }
+    writeMAXLogBuf(log);
+    close(log->fd);
+    free(log);
+}
+
+int mapMAXLog(const char *path, MAX_log_map *map)
+{
+    const struct MAX_log_header *header;
+    struct stat st;
+    int fd;
+
+    memset(map, 0, sizeof(*map));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct MAX_log_header))
+    {
+        close(fd);
+        return -1;
+    }
+    map->len = st.st_size;
+    map->addr = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map->addr == MAP_FAILED)
+    {
+        map->addr = NULL;
+        return -1;
+    }
+
+    header = map->header = map->addr;
+    if (memcmp(header->magic, MAX_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != MAX_LOG_BYTE_ORDER ||
+        !((header->format == MAXLogFixed &&
+           header->record_size == sizeof(struct MAX_log_record)) ||
+          (header->format == MAXLogDelta && header->record_size == 0)))
+    {
+        unmapMAXLog(map);
+        return -1;
+    }
+    map->data = (const uint8_t*)(header + 1);
+    map->size = map->len - sizeof(struct MAX_log_header);
+    if (header->format == MAXLogFixed)
+    {
+        map->record = (const struct MAX_log_record*)map->data;
+        map->count = map->size / sizeof(struct MAX_log_record);
+    }
+    /* Samples are read in sequence */
+    madvise(map->addr, map->len, MADV_SEQUENTIAL);
+
+    return 0;
+}
+
+void unmapMAXLog(MAX_log_map *map)
+{
+    if (map->addr != NULL)
+    {
+        munmap(map->addr, map->len);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+void loadMAXLogState(const struct MAX_log_record *rec,
+    struct MAX_device_state *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->rf_address = rec->rf_address;
+    state->flags = rec->flags;
+    state->mode = rec->mode;
+    state->battery_low = (rec->rec_flags & MAX_LOG_REC_BATTERY) != 0;
+    state->valve = rec->valve;
+    state->setpoint = rec->setpoint;
+    state->actual = rec->actual;
+}
+
+void initMAXLogDecoder(MAX_log_decoder *dec, const MAX_log_map *map,
+    size_t offset)
+{
+    dec->format = map->header->format;
+    dec->start = map->data;
+    dec->end = map->data + map->size;
+    dec->p = map->data + (offset < map->size ? offset : map->size);
+    if (dec->format == MAXLogFixed)
+    {
+        /* Only whole records */
+        dec->end -= map->size % sizeof(struct MAX_log_record);
+        if (dec->p > dec->end)
+        {
+            dec->p = dec->end;
+        }
+    }
+    dec->key = 0;
+    dec->time = 0;
+    dec->count = -1; /* no sample decoded yet, deltas cannot be applied */
+}
+
+static int nextMAXLogFixed(MAX_log_decoder *dec)
+{
+    const struct MAX_log_record *rec;
+
+    dec->count = 0;
+    while (dec->p < dec->end)
+    {
+        size_t i = (dec->p - dec->start) / sizeof(*rec);
+
+        rec = (const struct MAX_log_record*)dec->p;
+        if (i % MAX_LOG_SYNC_EVERY == 0)
+        {
+            if (!isMAXLogSync(rec))
+            {
+                return -1;
+            }
+            dec->p += sizeof(*rec);
+            continue;
+        }
+        if (rec->rec_flags & MAX_LOG_REC_FIRST)
+        {
+            if (dec->count > 0)
+            {
+                /* Start of the next sample */
+                break;
+            }
+            dec->time = rec->time;
+        }
+        else if (dec->count == 0)
+        {
+            return -1;
+        }
+        if (dec->count == MAX_LOG_DEVICES)
+        {
+            return -1;
+        }
+        loadMAXLogState(rec, &dec->state[dec->count++]);
+        dec->p += sizeof(*rec);
+    }
+    dec->key = 1;
+
+    return dec->count > 0;
+}
+
+static int nextMAXLogDelta(MAX_log_decoder *dec)
+{
+    const uint8_t *p = dec->p, *end;
+    uint32_t len, v, count;
+    int tag, i;
+
+    if (p == dec->end)
+    {
+        return 0;
+    }
+    tag = *p++;
+    if ((tag != MAX_LOG_TAG_KEY && tag != MAX_LOG_TAG_DELTA) ||
+        getMAXVarint(&p, dec->end, &len) < 0 || len > dec->end - p)
+    {
+        return -1;
+    }
+    end = p + len;
+
+    if (getMAXVarint(&p, end, &v) < 0 ||
+        getMAXVarint(&p, end, &count) < 0 || count > MAX_LOG_DEVICES)
+    {
+        return -1;
+    }
+    if (tag == MAX_LOG_TAG_KEY)
+    {
+        dec->time = v;
+        for (i = 0; i < count; i++)
+        {
+            struct MAX_device_state *st = &dec->state[i];
+            uint32_t f[7];
+            int j;
+
+            for (j = 0; j < 7; j++)
+            {
+                if (getMAXVarint(&p, end, &f[j]) < 0)
+                {
+                    return -1;
+                }
+            }
+            memset(st, 0, sizeof(*st));
+            st->rf_address = f[0];
+            st->valve = f[1];
+            st->setpoint = f[2];
+            st->actual = unzigzag(f[3]);
+            st->mode = f[4];
+            st->battery_low = (f[5] & MAX_LOG_REC_BATTERY) != 0;
+            st->flags = f[6];
+        }
+    }
+    else
+    {
+        /* A delta applies to the previous sample only */
+        if (dec->count < 0 || count != dec->count)
+        {
+            return -1;
+        }
+        dec->time += v;
+        for (i = 0; i < count; i++)
+        {
+            struct MAX_device_state *st = &dec->state[i];
+            int mask;
+
+            if (p == end)
+            {
+                return -1;
+            }
+            mask = *p++;
+            if ((mask & MAX_LOG_CHG_VALVE) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->valve += unzigzag(v);
+                mask &= ~MAX_LOG_CHG_VALVE;
+            }
+            if ((mask & MAX_LOG_CHG_SETPOINT) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->setpoint += unzigzag(v);
+                mask &= ~MAX_LOG_CHG_SETPOINT;
+            }
+            if ((mask & MAX_LOG_CHG_ACTUAL) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->actual += unzigzag(v);
+                mask &= ~MAX_LOG_CHG_ACTUAL;
+            }
+            if ((mask & MAX_LOG_CHG_MODE) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->mode = v;
+                mask &= ~MAX_LOG_CHG_MODE;
+            }
+            if ((mask & MAX_LOG_CHG_REC) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->battery_low = (v & MAX_LOG_REC_BATTERY) != 0;
+                mask &= ~MAX_LOG_CHG_REC;
+            }
+            if ((mask & MAX_LOG_CHG_FLAGS) &&
+                getMAXVarint(&p, end, &v) == 0)
+            {
+                st->flags = v;
+                mask &= ~MAX_LOG_CHG_FLAGS;
+            }
+            /* Unknown or truncated field */
+            if (mask != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    if (p != end)
+    {
+        return -1;
+    }
+    dec->key = (tag == MAX_LOG_TAG_KEY);
+    dec->count = count;
+    dec->p = end;
+
+    return 1;
+}
+
+int nextMAXLogSample(MAX_log_decoder *dec)
+{
+    if (dec->format == MAXLogDelta)
+    {
+        return nextMAXLogDelta(dec);
+    }
+    return nextMAXLogFixed(dec);
+}
+
+int dumpMAXLogText(FILE *fp, const MAX_log_map *map)
+{
+    MAX_log_decoder dec;
+    int res;
+
+    initMAXLogDecoder(&dec, map, 0);
+    while ((res = nextMAXLogSample(&dec)) > 0)
+    {
+        time_t t = dec.time;
+        char buf[64];
+
+        strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", localtime(&t));
+        fprintf(fp, "# %s\n", buf);
+        fputs(MAX_LOG_TEXT_HEADER, fp);
+        logMAXDeviceStates(fp, dec.state, dec.count);
+    }
+
+    return res;
+}
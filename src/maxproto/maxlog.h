@@ -0,0 +1,165 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#ifndef MAXLOG_H
+#define MAXLOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "maxmsg.h"
+
+/* Binary device log
+ * ==========================================
+ * A log file is a MAX_log_header followed by fixed size records, one per
+ * device and sample, appended in time order. Every MAX_LOG_SYNC_EVERY
+ * records a sync record is written so that a reader starting at any record
+ * boundary can check it is aligned. Numbers are in host byte order, the
+ * header tells which one. */
+#define MAX_LOG_MAGIC "MAXLOG"
+#define MAX_LOG_BYTE_ORDER 0x01020304
+#define MAX_LOG_SYNC_ADDR 0xffffffff /* rf_address of a sync record */
+#define MAX_LOG_SYNC_FLAGS 0x5359    /* "SY" */
+#define MAX_LOG_SYNC_EVERY 256
+
+/* Compressed device log
+ * ==========================================
+ * In the delta format the header is followed by one frame per sample:
+ *   tag (MAX_LOG_TAG_KEY or MAX_LOG_TAG_DELTA), varint payload length,
+ *   payload.
+ * A key frame payload holds the time, the number of devices and for each
+ * device its RF address, valve, set point, actual temperature (zigzag),
+ * mode, rec_flags and L flags, all as varints. A delta frame holds the
+ * seconds since the previous sample, the number of devices and for each
+ * device, in the order of the previous sample, a mask of MAX_LOG_CHG_*
+ * followed by the changed fields only, zigzag deltas for the numbers.
+ * A key frame is written every MAX_LOG_KEY_EVERY samples and whenever the
+ * device list changes, decoding can start at any key frame. */
+#define MAX_LOG_TAG_KEY   0xa5
+#define MAX_LOG_TAG_DELTA 0x5a
+#define MAX_LOG_KEY_EVERY 64
+#define MAX_LOG_DEVICES   256 /* Most devices in a sample, both formats */
+
+#define MAX_LOG_CHG_VALVE    0x01
+#define MAX_LOG_CHG_SETPOINT 0x02
+#define MAX_LOG_CHG_ACTUAL   0x04
+#define MAX_LOG_CHG_MODE     0x08
+#define MAX_LOG_CHG_REC      0x10
+#define MAX_LOG_CHG_FLAGS    0x20
+
+enum MAXLogFormat
+{
+    MAXLogFixed = 1,     /* struct MAX_log_record */
+    MAXLogDelta = 2      /* key and delta frames */
+};
+
+struct MAX_log_header {
+    char     magic[6];      /* MAX_LOG_MAGIC */
+    uint8_t  format;        /* enum MAXLogFormat */
+    uint8_t  record_size;   /* zero in the delta format */
+    uint32_t byte_order;    /* MAX_LOG_BYTE_ORDER */
+    uint32_t created;       /* seconds since the epoch */
+};
+
+struct MAX_log_record {
+    uint32_t time;          /* sample time, seconds since the epoch */
+    uint32_t rf_address;    /* or MAX_LOG_SYNC_ADDR */
+    uint8_t  valve;         /* as in struct MAX_device_state */
+    uint8_t  setpoint;
+    int16_t  actual;
+    uint8_t  mode;
+    uint8_t  rec_flags;     /* MAX_LOG_REC_* */
+    uint16_t flags;         /* L flags, MAX_LOG_SYNC_FLAGS in a sync record */
+};
+
+#define MAX_LOG_REC_BATTERY 0x01 /* battery low */
+#define MAX_LOG_REC_FIRST   0x02 /* first device of a sample */
+
+/* MAX_log_writer appends samples to a log file. Records are buffered and
+ * written when a sample is complete, a delta log always restarts with a key
+ * frame. */
+typedef struct MAX_log_writer MAX_log_writer;
+
+/* Open or create a log file for appending. A partial record or frame left
+ * at the end by an interrupted write is dropped. Return NULL if the file cannot be
+ * opened or is not a log of the given format. */
+MAX_log_writer* openMAXLog(const char *path, enum MAXLogFormat format);
+/* Append the states of 'count' devices sampled at 'time' and write them to
+ * the file. Return negative if an error has occured or if 'count' is above
+ * MAX_LOG_DEVICES. */
+int appendMAXLog(MAX_log_writer *log, uint32_t time,
+    const struct MAX_device_state *state, int count);
+void closeMAXLog(MAX_log_writer *log);
+
+/* MAX_log_map is a log file mapped in memory for reading */
+typedef struct MAX_log_map {
+    const struct MAX_log_header *header;
+    const uint8_t *data;    /* samples, after the header */
+    size_t size;
+    const struct MAX_log_record *record; /* fixed format only */
+    size_t count;           /* records, including the sync records */
+    void *addr;
+    size_t len;
+} MAX_log_map;
+
+/* Map a log file. Return negative if it cannot be mapped or is not a log
+ * written by a host with the same byte order. */
+int mapMAXLog(const char *path, MAX_log_map *map);
+void unmapMAXLog(MAX_log_map *map);
+
+static inline int isMAXLogSync(const struct MAX_log_record *rec)
+{
+    return rec->rf_address == MAX_LOG_SYNC_ADDR &&
+        rec->flags == MAX_LOG_SYNC_FLAGS;
+}
+
+/* Convert a record back to a device state */
+void loadMAXLogState(const struct MAX_log_record *rec,
+    struct MAX_device_state *state);
+
+/* MAX_log_decoder reads the samples of a log of any format one at a time,
+ * only the current sample is held in memory. */
+typedef struct MAX_log_decoder {
+    int format;
+    const uint8_t *p;       /* next byte to decode */
+    const uint8_t *start;
+    const uint8_t *end;
+    int key;                /* the current sample is a key frame */
+    uint32_t time;          /* current sample */
+    int count;
+    struct MAX_device_state state[MAX_LOG_DEVICES];
+} MAX_log_decoder;
+
+/* Start decoding a mapped log at byte 'offset' of its data, which must be
+ * the start of a key frame (or a sync record) */
+void initMAXLogDecoder(MAX_log_decoder *dec, const MAX_log_map *map,
+    size_t offset);
+/* Decode the next sample into dec->time, dec->count and dec->state. Return
+ * 1 if a sample was decoded, 0 at the end of the log and negative if the
+ * log is corrupted or ends with a partial sample. */
+int nextMAXLogSample(MAX_log_decoder *dec);
+
+/* Write a mapped log in the text format of logMAXHostDeviceList, one block
+ * per sample. Return negative if the log is corrupted. */
+int dumpMAXLogText(FILE *fp, const MAX_log_map *map);
+
+#endif /* MAXLOG_H */
@@ -26,9 +26,6 @@
 
 #include "maxmsg.h"
 
-/* Maximum number of set points per day */
-#define MAX_DAY_SETPOINTS 13
-
 static char* device_types[] = {
     "Cube",
     "RadiatorThermostat",
@@ -93,14 +90,101 @@ static char* bs_name[] = {
 /* Declare this as extern to avoid make it public in the headers */
 extern int parseMAXData(char *MAXData, int size, MAX_msg_list** msg_list);
 
+/* Decode the device list of an 'L' message */
+int decodeMAXDeviceList(MAX_msg_list *msg, struct MAX_device_state *state,
+    int max)
+{
+    struct MAX_message *m = getMAXmsg(msg);
+    const unsigned char *md, *end;
+    int count = 0;
+
+    if (m == NULL || m->type != 'L')
+    {
+        return -1;
+    }
+    md = (const unsigned char*)m->data;
+    end = (const unsigned char*)m + msg->MAX_msg_len;
+    while (md < end)
+    {
+        const struct L_Data *L_D = (const struct L_Data*)md;
+        int len = (unsigned char)L_D->Submessage_Length[0];
+
+        /* Stops also at the 0xce 0x00 terminator sent by some cubes */
+        if (len < 6 || md + len + 1 > end)
+        {
+            break;
+        }
+        if (count < max)
+        {
+            struct MAX_device_state *st = &state[count];
+
+            st->rf_address = (L_D->RF_Address[0] << 16) |
+                             (L_D->RF_Address[1] << 8) | L_D->RF_Address[2];
+            st->flags = (L_D->Flags[0] << 8) | L_D->Flags[1];
+            st->length = len;
+            st->mode = st->flags & MAX_L_FLAG_MODE;
+            st->battery_low = (st->flags & MAX_L_FLAG_BATTERY) != 0;
+            st->valve = MAX_STATE_NA;
+            st->setpoint = MAX_STATE_NA;
+            st->reserved = 0;
+            st->actual = -1;
+            if (len >= 8)
+            {
+                /* More info available */
+                st->valve = L_D->Valve_Position[0];
+                st->setpoint = L_D->Temperature[0] & 0x3f;
+                if (len >= 10 && st->mode == AutoTempMode)
+                {
+                    /* Actual temperature replaces the 'until' date */
+                    st->actual = ((L_D->next_data[0] & 0x01) << 8) |
+                                 L_D->next_data[1];
+                }
+            }
+        }
+        count++;
+        md += len + 1;
+    }
+    return count;
+}
+
+/* Decode the device list of an 'L' message in a newly allocated array */
+static struct MAX_device_state* loadMAXDeviceList(MAX_msg_list *msg,
+    int *count)
+{
+    struct MAX_device_state *state;
+    int n = decodeMAXDeviceList(msg, NULL, 0);
+
+    *count = 0;
+    if (n <= 0)
+    {
+        return NULL;
+    }
+    state = malloc(n * sizeof(*state));
+    if (state == NULL)
+    {
+        return NULL;
+    }
+    *count = decodeMAXDeviceList(msg, state, n);
+    return state;
+}
+
 /* Dump packet in host format */
 void dumpMAXHostpkt(MAX_msg_list* msg_list)
 {
     char buf[1024];
     while (msg_list != NULL) {
-        char* md = msg_list->MAX_msg->data;
-        printf("Message type %c\n", msg_list->MAX_msg->type);
-        switch (msg_list->MAX_msg->type)
+        struct MAX_message *msg = getMAXmsg(msg_list);
+        char* md;
+
+        if (msg == NULL)
+        {
+            /* Payload cannot be decoded */
+            msg_list = msg_list->next;
+            continue;
+        }
+        md = msg->data;
+        printf("Message type %c\n", msg->type);
+        switch (msg->type)
         {
             case 'H':
                 {
@@ -304,67 +388,47 @@ void dumpMAXHostpkt(MAX_msg_list* msg_list)
                 }
             case 'L':
                 {
-                    struct L_Data *L_D;
-                    unsigned char *tmp;
-                    int val, len, pos, tlen;
+                    struct MAX_device_state *state;
                     float fval;
-                    size_t hdr_sz = sizeof(struct MAX_message) - 1;
-                    
+                    int i, count;
+
                     printf("<<<<<<<<<<<<<<<<<<<< RX <<<<<<<<<<<<<<<<<<<<\n");
-                    pos = 0;
-                    tlen = msg_list->MAX_msg_len - hdr_sz;
-                    printf("\tTotal length        %d\n", tlen);
-                    while (1)
+                    printf("\tTotal length        %d\n",
+                           (int)(msg_list->MAX_msg_len -
+                                 (sizeof(struct MAX_message) - 1)));
+                    state = loadMAXDeviceList(msg_list, &count);
+                    for (i = 0; i < count; i++)
                     {
-                        char l_end[] = {0xce, 0x00};
-                        int flags_valid, mode = AutoTempMode;
-                        if (memcmp(md + pos, l_end, sizeof(l_end)) == 0)
+                        struct MAX_device_state *st = &state[i];
+                        int flags_valid = st->flags & MAX_L_FLAG_INIT;
+
+                        if (i > 0)
                         {
-                            /* Found terminator, exit */
-                            break;
+                            printf("\t----------------------\n");
                         }
-                        L_D = (struct L_Data*)(md + pos);
-                        val = L_D->Submessage_Length[0];
-                        len = val;
-                        printf("\tSubmessage Length   %d\n", val);
-                        tmp = L_D->RF_Address;
-                        printf("\tRF address          %x%x%x\n",
-                               tmp[0], tmp[1], tmp[2]);
-                        val = L_D->Flags[0];
-                        val = (val << 8) + L_D->Flags[1];
-                        flags_valid = val & 0b0001000000000;
+                        printf("\tSubmessage Length   %d\n", st->length);
+                        printf("\tRF address          %06x\n",
+                               st->rf_address);
                         if (flags_valid)
                         {
-                            int battery;
-                            battery = val & 0b10000000;
                             printf("\tBattery             %s\n",
-                                   battery_str[battery]);
-                            mode = val & 0b00000011;
+                                   battery_str[st->battery_low]);
                             printf("\tTemp mode           %s\n",
-                                   temp_mode_str[mode]);
+                                   temp_mode_str[st->mode]);
                         }
-                        if (len > 6)
+                        if (st->setpoint != MAX_STATE_NA)
                         {
-                            /* More info available */
-                            val = L_D->Valve_Position[0];
-                            printf("\tValve Position      %d%%\n", val);
-                            fval = L_D->Temperature[0] / 2.;
+                            printf("\tValve Position      %d%%\n", st->valve);
+                            fval = st->setpoint / 2.;
                             printf("\tTemperature         %.1f\n", fval);
-                            if (flags_valid && mode == AutoTempMode)
+                            if (flags_valid && st->actual >= 0)
                             {
-                                val = L_D->next_data[0] & 0b00000001;
-                                val = (val << 8) + L_D->next_data[1];
-                                fval = val / 10.;
+                                fval = st->actual / 10.;
                                 printf("\tActual temperature  %.1f\n", fval);
                             }
                         }
-                        pos += len + 1;
-                        if (pos >= tlen)
-                        {
-                            break;
-                        }
-                        printf("\t----------------------\n");
                     }
+                    free(state);
                     printf("<<<<<<<<<<<<<<<<<<<< RX <<<<<<<<<<<<<<<<<<<<\n");
                     break;
                 }
@@ -474,76 +538,55 @@ void dumpMAXHostpkt(MAX_msg_list* msg_list)
 }
 
 /* Log device list info */
+void logMAXDeviceStates(FILE *fp, const struct MAX_device_state *state,
+    int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const struct MAX_device_state *st = &state[i];
+
+        /* RF Address */
+        fprintf(fp, "%06x   ", st->rf_address);
+        if (st->setpoint != MAX_STATE_NA)
+        {
+            /* Valve position */
+            fprintf(fp, "%3d      ", st->valve);
+            /* Temperature set */
+            fprintf(fp, "%2.1f     ", st->setpoint / 2.);
+            if (st->actual >= 0)
+            {
+                /* Actual temperature */
+                fprintf(fp, "%2.1f", st->actual / 10.);
+            }
+            else
+            {
+                fprintf(fp, "NA");
+            }
+        }
+        else
+        {
+            fprintf(fp, "NA  NA");
+        }
+        fprintf(fp, "\n");
+    }
+}
+
 void logMAXHostDeviceList(FILE *fp, MAX_msg_list* msg_list)
 {
-    fprintf(fp, "#Addr    Valve(%%) TempSet  TempAct\n");
+    fputs(MAX_LOG_TEXT_HEADER, fp);
     while (msg_list != NULL) {
-        char* md = msg_list->MAX_msg->data;
         switch (msg_list->MAX_msg->type)
         {
             case 'L':
                 {
-                    struct L_Data *L_D;
-                    unsigned char *tmp;
-                    int val, len, pos, tlen;
-                    float fval;
-                    size_t hdr_sz = sizeof(struct MAX_message) - 1;
-                    
-                    pos = 0;
-                    tlen = msg_list->MAX_msg_len - hdr_sz;
-                    while (1)
-                    {
-                        char l_end[] = {0xce, 0x00};
-                        int mode;
+                    struct MAX_device_state *state;
+                    int count;
 
-                        if (memcmp(md + pos, l_end, sizeof(l_end)) == 0)
-                        {
-                            /* Found terminator, exit */
-                            break;
-                        }
-                        L_D = (struct L_Data*)(md + pos);
-                        val = L_D->Submessage_Length[0];
-                        len = val;
-                        tmp = L_D->RF_Address;
-                        /* RF Address */
-                        fprintf(fp, "%2x%2x%2x   ",
-                               tmp[0], tmp[1], tmp[2]);
-                        val = L_D->Flags[0];
-                        val = (val << 8) + L_D->Flags[1];
-                        mode = val & 0b00000011;
-                        if (len > 6)
-                        {
-                            /* More info available */
-                            val = L_D->Valve_Position[0];
-                            /* Valve position */
-                            fprintf(fp, "%3d      ", val);
-                            fval = L_D->Temperature[0] / 2.;
-                            /* Temperature set */
-                            fprintf(fp, "%2.1f     ", fval);
-                            if (mode == AutoTempMode)
-                            {
-                                val = L_D->next_data[0] & 0b00000001;
-                                val = (val << 8) + L_D->next_data[1];
-                                fval = val / 10.;
-                                /* Actual temperature */
-                                fprintf(fp, "%2.1f", fval);
-                            }
-                            else
-                            {
-                                fprintf(fp, "NA");
-                            }    
-                        }
-                        else
-                        {
-                            fprintf(fp, "NA  NA");
-                        }    
-                        pos += len + 1;
-                        fprintf(fp, "\n");
-                        if (pos >= tlen)
-                        {
-                            break;
-                        }
-                    }
+                    state = loadMAXDeviceList(msg_list, &count);
+                    logMAXDeviceStates(fp, state, count);
+                    free(state);
                     break;
                 }
             default:
@@ -553,10 +596,160 @@ void logMAXHostDeviceList(FILE *fp, MAX_msg_list* msg_list)
     }
 }
 
+/* Initial number of slots of the config index, power of 2 */
+#define CFG_INDEX_SZ 64
+
+/* Open addressing hash table of the 'C' messages of a packet, keyed by RF
+ * address. Empty slots have a NULL msg. */
+struct MAX_cfg_index {
+    uint32_t size;  /* number of slots, a power of two */
+    uint32_t shift; /* 32 - log2(size) */
+    uint32_t count; /* number of used slots */
+    struct MAX_cfg_slot {
+        uint32_t rf_address;
+        MAX_msg_list *msg;
+    } slot[1];
+};
+
+/* Index of a packet where a 'C' message could not be indexed. Lookups search
+ * the list and no new index is built for the packet. */
+static struct MAX_cfg_index cfg_index_off;
+
+/* Parse the 6 hex digits RF address of a 'C' message. Return
+ * NOT_AN_RF_ADDRESS if not a valid address */
+#define NOT_AN_RF_ADDRESS 0xffffffff
+static uint32_t hexMAXRFAddress(const char *hex)
+{
+    uint32_t rf_address = 0;
+    int i;
+
+    for (i = 0; i < 6; i++)
+    {
+        char c = hex[i];
+
+        rf_address <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            rf_address |= c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            rf_address |= c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            rf_address |= c - 'A' + 10;
+        }
+        else
+        {
+            return NOT_AN_RF_ADDRESS;
+        }
+    }
+    return rf_address;
+}
+
+/* Fibonacci hashing of the 24 bit address. The top bits of the product
+ * depend on all the address bits, the low ones only on the low bits. */
+static inline uint32_t hashMAXRFAddress(uint32_t rf_address, uint32_t shift)
+{
+    return (rf_address * 2654435761u) >> shift;
+}
+
+static struct MAX_cfg_slot* lookupMAXCfgIndex(struct MAX_cfg_index *index,
+        uint32_t rf_address)
+{
+    uint32_t i = hashMAXRFAddress(rf_address, index->shift);
+
+    /* Linear probing, the table is never more than half full */
+    while (index->slot[i].msg != NULL &&
+           index->slot[i].rf_address != rf_address)
+    {
+        i = (i + 1) & (index->size - 1);
+    }
+    return &index->slot[i];
+}
+
+static struct MAX_cfg_index* newMAXCfgIndex(MAX_arena *arena, uint32_t size)
+{
+    struct MAX_cfg_index *index;
+    size_t len = sizeof(struct MAX_cfg_index) +
+                 (size - 1) * sizeof(struct MAX_cfg_slot);
+
+    index = allocMAXArena(arena, len);
+    if (index != NULL)
+    {
+        memset(index, 0, len);
+        index->size = size;
+        for (index->shift = 32; size > 1; size >>= 1)
+        {
+            index->shift--;
+        }
+    }
+    return index;
+}
+
+/* Add a 'C' message of a received packet to the index of the packet. Called
+ * by the parser, the index lives in the arena of the packet. */
+int indexMAXConfig(MAX_msg_list *msg_list, MAX_msg_list *msg)
+{
+    struct MAX_cfg_index *index = msg_list->cfg_index;
+    struct C_Data *C_D = (struct C_Data*)msg->MAX_msg->data;
+    struct MAX_cfg_slot *slot;
+    uint32_t rf_address, i;
+
+    if (msg_list->arena == NULL || index == &cfg_index_off)
+    {
+        return -1;
+    }
+    rf_address = hexMAXRFAddress(C_D->RF_address);
+    if (rf_address == NOT_AN_RF_ADDRESS)
+    {
+        return -1;
+    }
+    if (index == NULL || (index->count + 1) * 2 > index->size)
+    {
+        /* Create or grow the table, the old one is released with the
+         * arena */
+        struct MAX_cfg_index *new_index;
+
+        new_index = newMAXCfgIndex(msg_list->arena,
+                                   index ? index->size * 2 : CFG_INDEX_SZ);
+        if (new_index == NULL)
+        {
+            /* Incomplete index is not usable, fall back to list search */
+            msg_list->cfg_index = &cfg_index_off;
+            return -1;
+        }
+        for (i = 0; index != NULL && i < index->size; i++)
+        {
+            if (index->slot[i].msg != NULL)
+            {
+                *lookupMAXCfgIndex(new_index, index->slot[i].rf_address) =
+                    index->slot[i];
+                new_index->count++;
+            }
+        }
+        index = msg_list->cfg_index = new_index;
+    }
+    slot = lookupMAXCfgIndex(index, rf_address);
+    if (slot->msg == NULL)
+    {
+        /* Keep the first message of a device, like a list search does */
+        slot->rf_address = rf_address;
+        slot->msg = msg;
+        index->count++;
+    }
+    return 0;
+}
+
 unsigned char* findMAXDaySchedule(uint16_t day, MAX_msg_list *msg_list)
 {
+    size_t min_len = sizeof(struct MAX_message) - 1 + sizeof(struct C_Data) +
+                     sizeof(union C_Data_Device) + sizeof(struct rtc);
 
-    if (msg_list && msg_list->MAX_msg->type == 'C')
+    if (msg_list && msg_list->MAX_msg->type == 'C' &&
+        getMAXmsg(msg_list) != NULL && msg_list->MAX_msg_len >= min_len &&
+        day < MAX_WEEK_DAYS)
     {
         char* md = msg_list->MAX_msg->data;
         union C_Data_Device *data =
@@ -564,35 +757,13 @@ unsigned char* findMAXDaySchedule(uint16_t day, MAX_msg_list *msg_list)
 
         if (data->device.Device_Type[0] == RadiatorThermostat)
         {
-            int msg_day, hours;
-            uint16_t ws;
-            int s;
             union C_Data_Config *config =
                     (union C_Data_Config*)((char*)data +
                     sizeof(union C_Data_Device));
 
-            s = 0;
-            msg_day = 0;
-            while (s < sizeof(config->rtc.Weekly_Program))
-            {
-                if (msg_day == day)
-                {
-                    return &config->rtc.Weekly_Program[s];
-                }
-                ws = (((config->rtc.Weekly_Program[s] & 1) << 8)
-                     | config->rtc.Weekly_Program[s + 1]) * 5;
-                hours = ws / 60;
-                if (hours >= 24)
-                {
-                    s = (s / (MAX_DAY_SETPOINTS * 2) + 1) *
-                        MAX_DAY_SETPOINTS* 2;
-                    msg_day++;
-                }
-                else
-                {
-                    s += 2;
-                }
-            }
+            /* Every day takes MAX_DAY_SETPOINTS pairs, unused pairs repeat
+             * the last set point */
+            return &config->rtc.Weekly_Program[day * MAX_DAY_SETPOINTS * 2];
         }
     }
     return NULL;
@@ -600,19 +771,20 @@ unsigned char* findMAXDaySchedule(uint16_t day, MAX_msg_list *msg_list)
 
 MAX_msg_list* findMAXConfig(uint32_t rf_address, MAX_msg_list *msg_list)
 {
-    char buf[1024];
+    if (msg_list != NULL && msg_list->prev == NULL &&
+        msg_list->cfg_index != NULL && msg_list->cfg_index != &cfg_index_off)
+    {
+        return lookupMAXCfgIndex(msg_list->cfg_index, rf_address)->msg;
+    }
 
     while (msg_list != NULL) {
         if (msg_list->MAX_msg && msg_list->MAX_msg->type == 'C')
         {
-            char* md = msg_list->MAX_msg->data;
-            /* Check if this message is for our device */
-            struct C_Data *C_D = (struct C_Data*)md;
-            uint32_t msg_rf_address;
+            /* RF address is not base64 encoded, no need to decode */
+            struct C_Data *C_D = (struct C_Data*)msg_list->MAX_msg->data;
 
-            snprintf(buf, sizeof(C_D->RF_address) + 1, "%s", C_D->RF_address);
-            msg_rf_address = strtol(buf, NULL, 16);
-            if (rf_address == msg_rf_address)
+            /* Check if this message is for our device */
+            if (rf_address == hexMAXRFAddress(C_D->RF_address))
             {
                 return msg_list;
             }
@@ -622,9 +794,49 @@ MAX_msg_list* findMAXConfig(uint32_t rf_address, MAX_msg_list *msg_list)
     return NULL;
 }
 
+int findMAXRoomDevices(int room_id, MAX_msg_list *msg_list,
+    uint32_t *rf_address, int max)
+{
+    size_t min_len = sizeof(struct MAX_message) - 1 + sizeof(struct C_Data) +
+                     sizeof(union C_Data_Device);
+    int count = 0;
+
+    while (msg_list != NULL) {
+        if (msg_list->MAX_msg->type == 'C' && getMAXmsg(msg_list) != NULL &&
+            msg_list->MAX_msg_len >= min_len)
+        {
+            struct C_Data *C_D = (struct C_Data*)msg_list->MAX_msg->data;
+            union C_Data_Device *data =
+                (union C_Data_Device*)((char*)C_D + sizeof(struct C_Data));
+
+            switch (data->device.Device_Type[0])
+            {
+                case RadiatorThermostat:
+                case RadiatorThermostatPlus:
+                case WallThermostat:
+                    if (data->device.Room_ID[0] == room_id)
+                    {
+                        if (count < max)
+                        {
+                            rf_address[count] =
+                                hexMAXRFAddress(C_D->RF_address);
+                        }
+                        count++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        msg_list = msg_list->next;
+    }
+    return count;
+}
+
 int cmpMAXConfigParam(MAX_msg_list *msg_list, int param, void *value)
 {
-    if (msg_list && msg_list->MAX_msg && msg_list->MAX_msg->type == 'C')
+    if (msg_list && msg_list->MAX_msg && msg_list->MAX_msg->type == 'C' &&
+        getMAXmsg(msg_list) != NULL)
     {
         char* md = msg_list->MAX_msg->data;
         union C_Data_Device *data =
@@ -688,41 +900,58 @@ void dumpMAXNetpkt(MAX_msg_list* msg_list)
     }
     dumpMAXHostpkt(tmpmsg_list);
     /* free the temporary allocated data */
-    free(tmpmsg_list);
+    freeMAXpkt(&tmpmsg_list);
 }
 
 void freeMAXpkt(MAX_msg_list** msg_list)
 {
     MAX_msg_list *msg = NULL, *iter = *msg_list;
+    MAX_arena *arena = NULL;
 
     while (iter != NULL) {
         msg = iter;
         iter = iter->next;
+        if (msg->arena != NULL)
+        {
+            /* Released at once with the arena */
+            arena = msg->arena;
+            continue;
+        }
         free(msg->MAX_msg);
         free(msg);
     }
+    freeMAXArena(arena);
     *msg_list = NULL;
 }
 
+MAX_msg_list* linkMAXmsg(MAX_msg_list* msg_list, MAX_msg_list *newmsg,
+    struct MAX_message *msg, size_t msg_len)
+{
+    newmsg->MAX_msg = msg;
+    newmsg->MAX_msg_len = msg_len;
+    newmsg->arena = NULL;
+    newmsg->encoded = 0;
+    newmsg->cfg_index = NULL;
+    newmsg->next = NULL;
+    if (msg_list == NULL)
+    {
+        newmsg->prev = NULL;
+        newmsg->last = newmsg;
+        return newmsg;
+    }
+    newmsg->prev = msg_list->last;
+    newmsg->last = NULL;
+    msg_list->last->next = newmsg;
+    msg_list->last = newmsg;
+    return msg_list;
+}
+
 MAX_msg_list* appendMAXmsg(MAX_msg_list* msg_list, struct MAX_message *msg,
     size_t msg_len)
 {
     MAX_msg_list *newmsg = (MAX_msg_list*)malloc(sizeof(MAX_msg_list));
-    MAX_msg_list *resmsg = newmsg;
 
-    if (msg_list != NULL)
-    {
-        resmsg = msg_list;
-        while (msg_list->next != NULL) {
-            msg_list = msg_list->next;
-        }
-        msg_list->next = newmsg;
-    }
-    newmsg->MAX_msg = msg;
-    newmsg->MAX_msg_len = msg_len;
-    newmsg->prev = msg_list;
-    newmsg->next = NULL;
-    return resmsg;
+    return linkMAXmsg(msg_list, newmsg, msg, msg_len);
 }
 
 int base_string_index(const char *base_string)
@@ -731,7 +960,10 @@ int base_string_index(const char *base_string)
 
     for(i = 0; i < sizeof(bs_code) / sizeof(bs_code[0]); i++)
     {
-        if (memcmp(bs_code[i].value, base_string, BS_CODE_SZ) == 0)
+        /* The flags don't change the command */
+        if (memcmp(bs_code[i].value, base_string, BS_FLAGS) == 0 &&
+            memcmp(bs_code[i].value + BS_FLAGS + 1, base_string + BS_FLAGS + 1,
+                   BS_CODE_SZ - BS_FLAGS - 1) == 0)
         {
             return i;
         }
@@ -39,8 +39,11 @@
 #ifndef MAXMSG_H
 #define MAXMSG_H
 
+#include <stdint.h>
 #include <stdio.h>
 
+#include "maxarena.h"
+
 enum MaxDeviceType
 {
     Cube = 0,
@@ -59,6 +62,9 @@ enum MaxConfigParam
 
 /* Size of the code in chars */
 #define BS_CODE_SZ  6
+/* Flags in the second byte of the base string */
+#define BS_FLAGS        1
+#define BS_FLAG_GROUP   0x04 /* for all the devices of Room_Nr */
 
 enum BSIndex
 {
@@ -79,15 +85,31 @@ struct MAX_message {
 };
 
 /* MAX_msg_list is structure used to implement a list of messages that are
- * part of a packet */
+ * part of a packet. 'last' is kept up to date in the first element only, it
+ * allows appending without walking the list. Received packets are allocated
+ * in an arena, 'arena' is NULL for elements and messages allocated with
+ * malloc. If 'encoded' is set MAX_msg still holds the message as received,
+ * use getMAXmsg to access the payload. 'cfg_index' indexes the 'C' messages
+ * of a received packet by RF address, it is kept in the first element only
+ * as well. */
 typedef struct MME
 {
     struct MME *prev;
     struct MME *next;
+    struct MME *last;
     size_t MAX_msg_len;
     struct MAX_message *MAX_msg;
+    MAX_arena *arena;
+    int encoded;
+    struct MAX_cfg_index *cfg_index;
 } MAX_msg_list;
 
+enum MaxDecodeMode
+{
+    MAXDecodeEager = 0, /* decode C and L messages when they are received */
+    MAXDecodeLazy = 1   /* decode C and L messages on first access */
+};
+
 /* Message definitions
  * ==========================================
  * Data structures describe payload of messages in host format. Some of the
@@ -171,6 +193,11 @@ union C_Data_Device {
     } device;
 };
 
+/* Days in the weekly program, starting with Saturday */
+#define MAX_WEEK_DAYS 7
+/* Maximum number of set points per day */
+#define MAX_DAY_SETPOINTS 13
+
 /* union C_Data_Config - decoded from Base64 payload in C message */
 union C_Data_Config {
     struct cubec {
@@ -191,7 +218,7 @@ union C_Data_Config {
         unsigned char Decalcification[1];
         unsigned char Max_Valve_Setting[1];
         unsigned char Valve_Offset[1];
-        unsigned char Weekly_Program[182];
+        unsigned char Weekly_Program[MAX_WEEK_DAYS * MAX_DAY_SETPOINTS * 2];
     } rtc;
 };
 
@@ -218,6 +245,31 @@ struct L_Data {
     unsigned char next_data[1];
 };
 
+/* Flags field of an L submessage */
+#define MAX_L_FLAG_INIT     0x0200 /* status initialized */
+#define MAX_L_FLAG_BATTERY  0x0080 /* battery low */
+#define MAX_L_FLAG_MODE     0x0003 /* enum TempMode */
+
+/* Value not reported by the device */
+#define MAX_STATE_NA        0xff
+
+/* Column header of a sample in text logs */
+#define MAX_LOG_TEXT_HEADER "#Addr    Valve(%) TempSet  TempAct\n"
+
+/* struct MAX_device_state - state of one device, decoded from an L
+ * submessage */
+struct MAX_device_state {
+    uint32_t rf_address;
+    uint16_t flags;       /* see MAX_L_FLAG_* */
+    uint8_t  length;      /* submessage length */
+    uint8_t  mode;        /* enum TempMode */
+    uint8_t  battery_low;
+    uint8_t  valve;       /* valve position in %, or MAX_STATE_NA */
+    uint8_t  setpoint;    /* set temperature in 0.5 degrees, or MAX_STATE_NA */
+    uint8_t  reserved;
+    int16_t  actual;      /* actual temperature in 0.1 degrees, or -1 */
+};
+
 /* struct Discover_Data - HEX payload in Discover reply */
 struct Discover_Data {
     char Name[8];
@@ -289,13 +341,8 @@ struct s_Program_Data {
     unsigned char RF_Address[3];
     unsigned char Room_Nr[1];
     unsigned char Day_of_week[1];
-    unsigned char Temp_and_Time[2];
-    unsigned char Temp_and_Time2[2];
-    unsigned char Temp_and_Time3[2];
-    unsigned char Temp_and_Time4[2];
-    unsigned char Temp_and_Time5[2];
-    unsigned char Temp_and_Time6[2];
-    unsigned char Temp_and_Time7[2];
+    /* MAX_CMD_SETPOINTS pairs of temperature and time */
+    unsigned char Temp_and_Time[MAX_CMD_SETPOINTS * 2];
 };
 
 enum TempMode
@@ -341,19 +388,48 @@ struct l_Data {
     char CRLF[2]; /* reserved for '\n\r' */
 };
 
+/* Select when base64 encoded messages are decoded, see enum MaxDecodeMode */
+void setMAXDecodeMode(int mode);
+/* Return the message in host format, decoding it if needed. The message type
+ * can be read from MAX_msg without decoding. Return NULL if the payload is
+ * not valid. */
+struct MAX_message* getMAXmsg(MAX_msg_list *msg);
+
+/* Decode the device list of the 'L' message 'msg' into at most 'max' records
+ * in 'state'. Return the number of devices in the message, which can be
+ * larger than 'max', or -1 if the message cannot be decoded. */
+int decodeMAXDeviceList(MAX_msg_list *msg, struct MAX_device_state *state,
+    int max);
+
 /* Dump packet in host format */
 void dumpMAXHostpkt(MAX_msg_list* msg_list);
 /* Log device list info in file */
 void logMAXHostDeviceList(FILE *fp, MAX_msg_list* msg_list);
+/* Log the lines of 'count' device states in the format of
+ * logMAXHostDeviceList, after its MAX_LOG_TEXT_HEADER */
+void logMAXDeviceStates(FILE *fp, const struct MAX_device_state *state,
+    int count);
 /* Dump packet in network format */
 void dumpMAXNetpkt(MAX_msg_list* msg_list);
-/* Free all elements in a message list */
+/* Free all elements in a message list. Messages allocated in an arena are
+ * released at once together with the arena. */
 void freeMAXpkt(MAX_msg_list **msg_list);
-/* Return a pointer to the day schedule in the message */
+/* Return a pointer to the MAX_DAY_SETPOINTS pairs of the day schedule in a
+ * 'C' message, NULL if the message has no weekly program */
 unsigned char* findMAXDaySchedule(uint16_t day, MAX_msg_list *msg_list);
 /* find 'C' message in a message list that corresponds to a device by
- * rf_address */
+ * rf_address. The packet index is used when msg_list is the first element
+ * of a received packet, otherwise the list is searched from msg_list on. */
 MAX_msg_list* findMAXConfig(uint32_t rf_address, MAX_msg_list *msg_list);
+/* Add the 'C' message 'msg' to the index of the received packet msg_list.
+ * Called by the parser, not meant for other callers. Return negative if the
+ * message is not indexed. */
+int indexMAXConfig(MAX_msg_list *msg_list, MAX_msg_list *msg);
+/* Store in 'rf_address' the addresses of at most 'max' thermostats that the
+ * 'C' messages of a packet place in room 'room_id'. Return the number of such
+ * thermostats, which can be larger than 'max'. */
+int findMAXRoomDevices(int room_id, MAX_msg_list *msg_list,
+    uint32_t *rf_address, int max);
 /* Compare config parameter with the one from a message.
  * Return '0' if the same 'value' is found in the message list */
 int cmpMAXConfigParam(MAX_msg_list *msg_list, int param, void *value);
@@ -364,6 +440,12 @@ int cmpMAXConfigParam(MAX_msg_list *msg_list, int param, void *value);
 MAX_msg_list* appendMAXmsg(MAX_msg_list* msg_list, struct MAX_message *msg,
     size_t msg_len);
 
+/* Same as appendMAXmsg but 'newmsg' is provided by the caller, e.g. on the
+ * stack, to gather messages sent at once with MAXMsgSend. Such a list must not
+ * be released with freeMAXpkt. */
+MAX_msg_list* linkMAXmsg(MAX_msg_list* msg_list, MAX_msg_list *newmsg,
+    struct MAX_message *msg, size_t msg_len);
+
 /* Returns the index of the given base string */
 int base_string_index(const char *base_string);
 /* Returns a string representing the base string situated at 'index' position in
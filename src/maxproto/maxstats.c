@@ -0,0 +1,233 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <string.h>
+#include <time.h>
+
+#include "maxstats.h"
+
+#define MAX_STAT_DUMP_MAGIC "MAXSTAT"
+
+/* Buckets per power of two, values below it have a bucket each */
+#define MAX_STAT_SUB_BITS 3
+#define MAX_STAT_SUB (1 << MAX_STAT_SUB_BITS)
+#define MAX_STAT_BUCKETS ((64 - MAX_STAT_SUB_BITS + 1) * MAX_STAT_SUB)
+
+struct MAX_histogram {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t bucket[MAX_STAT_BUCKETS];
+};
+
+static const char *stat_names[MAXStatCount] = {
+    "connect", "recv", "parse", "decode", "diff", "cmd"
+};
+
+/* Histograms passed to another process by dumpMAXStats */
+struct MAX_stats_dump {
+    char magic[8];
+    struct MAX_histogram stats[MAXStatCount];
+};
+
+static int stats_on;
+static struct MAX_histogram stats[MAXStatCount];
+
+void enableMAXStats(int on)
+{
+    stats_on = on;
+}
+
+void resetMAXStats(void)
+{
+    memset(stats, 0, sizeof(stats));
+}
+
+uint64_t startMAXStat(void)
+{
+    struct timespec ts;
+
+    if (!stats_on)
+    {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucketMAXStat(uint64_t ns)
+{
+    int k;
+
+    if (ns < MAX_STAT_SUB)
+    {
+        return (int)ns;
+    }
+    k = 63 - __builtin_clzll(ns);
+    return (k - MAX_STAT_SUB_BITS + 1) * MAX_STAT_SUB +
+           (int)((ns >> (k - MAX_STAT_SUB_BITS)) & (MAX_STAT_SUB - 1));
+}
+
+/* Middle of bucket 'i' */
+static double valueMAXStat(int i)
+{
+    int k = i / MAX_STAT_SUB + MAX_STAT_SUB_BITS - 1;
+    uint64_t width;
+
+    if (i < MAX_STAT_SUB)
+    {
+        return i;
+    }
+    width = (uint64_t)1 << (k - MAX_STAT_SUB_BITS);
+    return (double)((MAX_STAT_SUB + i % MAX_STAT_SUB) * width) + width / 2.0;
+}
+
+void endMAXStat(int stat, uint64_t start)
+{
+    struct MAX_histogram *h = &stats[stat];
+    uint64_t ns;
+
+    if (start == 0)
+    {
+        return;
+    }
+    ns = startMAXStat() - start;
+    if (h->count == 0 || ns < h->min)
+    {
+        h->min = ns;
+    }
+    if (ns > h->max)
+    {
+        h->max = ns;
+    }
+    h->count++;
+    h->total += ns;
+    h->bucket[bucketMAXStat(ns)]++;
+}
+
+/* Value (ns) below which fall 'p' percent of the samples */
+static double percentileMAXStat(const struct MAX_histogram *h, int p)
+{
+    uint64_t rank = (h->count * p + 99) / 100, seen = 0;
+    double v;
+    int i;
+
+    for (i = 0; i < MAX_STAT_BUCKETS; i++)
+    {
+        seen += h->bucket[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+    /* The bucket middle may be out of the range actually seen */
+    v = valueMAXStat(i);
+    if (v < h->min)
+    {
+        v = h->min;
+    }
+    if (v > h->max)
+    {
+        v = h->max;
+    }
+    return v;
+}
+
+void printMAXStats(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "{");
+    for (i = 0; i < MAXStatCount; i++)
+    {
+        const struct MAX_histogram *h = &stats[i];
+
+        fprintf(fp, "%s\n  \"%s\": {\"count\": %llu", i ? "," : "",
+                stat_names[i], (unsigned long long)h->count);
+        if (h->count > 0)
+        {
+            fprintf(fp, ", \"p50_us\": %.3f, \"p90_us\": %.3f, "
+                    "\"p99_us\": %.3f, \"max_us\": %.3f, \"total_us\": %.3f",
+                    percentileMAXStat(h, 50) / 1000,
+                    percentileMAXStat(h, 90) / 1000,
+                    percentileMAXStat(h, 99) / 1000, h->max / 1000.0,
+                    h->total / 1000.0);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n}\n");
+}
+
+size_t dumpMAXStats(void *buf, size_t len)
+{
+    struct MAX_stats_dump *dump = buf;
+
+    if (len >= sizeof(*dump))
+    {
+        memcpy(dump->magic, MAX_STAT_DUMP_MAGIC, sizeof(dump->magic));
+        memcpy(dump->stats, stats, sizeof(stats));
+    }
+    return sizeof(*dump);
+}
+
+int mergeMAXStats(const void *buf, size_t len)
+{
+    struct MAX_stats_dump dump;
+    int i, j;
+
+    if (len != sizeof(dump))
+    {
+        return -1;
+    }
+    /* 'buf' may not be aligned */
+    memcpy(&dump, buf, sizeof(dump));
+    if (memcmp(dump.magic, MAX_STAT_DUMP_MAGIC, sizeof(dump.magic)) != 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < MAXStatCount; i++)
+    {
+        struct MAX_histogram *h = &stats[i];
+        const struct MAX_histogram *d = &dump.stats[i];
+
+        if (d->count == 0)
+        {
+            continue;
+        }
+        if (h->count == 0 || d->min < h->min)
+        {
+            h->min = d->min;
+        }
+        if (d->max > h->max)
+        {
+            h->max = d->max;
+        }
+        h->count += d->count;
+        h->total += d->total;
+        for (j = 0; j < MAX_STAT_BUCKETS; j++)
+        {
+            h->bucket[j] += d->bucket[j];
+        }
+    }
+
+    return 0;
+}
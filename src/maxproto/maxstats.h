@@ -0,0 +1,64 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#ifndef MAXSTATS_H
+#define MAXSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Latency probes
+ * ==========================================
+ * A probe times one phase of a session with CLOCK_MONOTONIC and adds the
+ * duration to the histogram of the phase. Histograms have 8 buckets per
+ * power of two, percentiles are within 1/16 of the true value. Probes cost
+ * a single test until enableMAXStats() is called. */
+enum MAXStat
+{
+    MAXStatConnect,     /* MAXConnectTmo */
+    MAXStatRecv,        /* one call of MaxMsgRecv, MaxMsgRecvTmo or
+                         * MaxMsgRecvUntil */
+    MAXStatParse,       /* parsing the messages of one read, base64 decoding
+                         * included unless decoding is lazy */
+    MAXStatDecode,      /* lazy decoding of a C or L message by getMAXmsg */
+    MAXStatDiff,        /* flag_ruleset over the Hello burst */
+    MAXStatCmd,         /* 's' command sent until its 'S' reply */
+    MAXStatCount
+};
+
+void enableMAXStats(int on);
+void resetMAXStats(void);
+/* Return the start time of a probe, 0 if stats are disabled */
+uint64_t startMAXStat(void);
+/* Add the time elapsed since 'start' to the histogram of 'stat'. Nothing is
+ * done if 'start' is 0. */
+void endMAXStat(int stat, uint64_t start);
+/* Write the histograms as a JSON object, times in microseconds */
+void printMAXStats(FILE *fp);
+/* Copy the histograms into 'buf' so that another process of the same program
+ * can merge them. Return the size of the copy, nothing is copied if 'len' is
+ * smaller. */
+size_t dumpMAXStats(void *buf, size_t len);
+/* Add the histograms copied by dumpMAXStats to ours. Return negative if 'buf'
+ * does not hold such a copy. */
+int mergeMAXStats(const void *buf, size_t len);
+
+#endif /* MAXSTATS_H */
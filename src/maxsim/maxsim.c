@@ -0,0 +1,985 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+/* maxsim is a stand-in for a MAX! cube, to test maxctl without hardware. It
+ * answers discovery probes and serves one client at a time like a cube: a
+ * Hello burst for a number of simulated radiator thermostats, then 's'
+ * commands, 'l' and 'q'. Replies are delayed by a configurable round trip
+ * time and jitter, 's' commands use a modeled radio duty cycle. */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "max.h"
+#include "maxmsg.h"
+#include "base64.h"
+#include "simconf.h"
+
+#define SIM_DEVICES 4        /* Default number of thermostats */
+#define SIM_DEVICES_MAX 255 /* counted in one byte in the metadata */
+#define SIM_ROOMS 4          /* Default number of rooms */
+#define SIM_SERIAL "KEQ0000001"
+#define SIM_RF_ADDRESS 0x0b6444
+#define SIM_FREE_SLOTS 0x32
+#define SIM_COST 1.0         /* Duty cycle used by one 's' command (%) */
+#define SIM_DUTY_DECAY_MS 36000 /* Time for the duty cycle to fall by 1% */
+#define SIM_DUTY_MAX 100
+#define SIM_RX_SZ 4096
+
+#define SERIAL_LEN sizeof(((struct Discover_Data*)0)->Serial_number)
+
+/* struct sim_device - state of a simulated radiator thermostat. Temperatures
+ * are in 0.5 degrees like on the wire, 'actual' in 0.1 degrees. */
+struct sim_device {
+    uint32_t rf_address;
+    int room_id;
+    int mode;                /* enum TempMode */
+    int setpoint;
+    int actual;
+    int valve;
+    unsigned char comfort;
+    unsigned char eco;
+    unsigned char program[MAX_WEEK_DAYS][MAX_DAY_SETPOINTS * 2];
+};
+
+/* struct sim_reply - data sent to the client once 'due' (ms) is reached */
+struct sim_reply {
+    struct sim_reply *next;
+    long long due;
+    size_t len;
+    char data[1];
+};
+
+struct sim {
+    const char *serial;
+    int rtt;                 /* ms added to every reply */
+    int jitter;              /* up to this many ms added on top of 'rtt' */
+    int radio;               /* ms of air time of one 's' command */
+    double cost;
+    int decay;
+    int verbose;
+    struct sim_device *dev;
+    int ndev;
+    int nrooms;
+    double duty;
+    long long duty_time;
+    long long radio_free;    /* the radio is busy until then */
+    struct sim_reply *head;
+    struct sim_reply *tail;
+    long commands;
+    long rejected;
+};
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Reply time after the request has been handled */
+static long long reply_delay(struct sim *sim)
+{
+    return sim->rtt + (sim->jitter > 0 ? rand() % (sim->jitter + 1) : 0);
+}
+
+/* Queue data for the client. TCP keeps the order, a reply is never sent
+ * before the previous ones even with jitter. */
+static int queue_reply(struct sim *sim, const char *data, size_t len,
+        long long due)
+{
+    struct sim_reply *reply = malloc(sizeof(*reply) + len);
+
+    if (reply == NULL)
+    {
+        return -1;
+    }
+    if (sim->tail != NULL && due < sim->tail->due)
+    {
+        due = sim->tail->due;
+    }
+    reply->next = NULL;
+    reply->due = due;
+    reply->len = len;
+    memcpy(reply->data, data, len);
+    if (sim->tail != NULL)
+    {
+        sim->tail->next = reply;
+    }
+    else
+    {
+        sim->head = reply;
+    }
+    sim->tail = reply;
+    return 0;
+}
+
+static void drop_replies(struct sim *sim)
+{
+    while (sim->head != NULL)
+    {
+        struct sim_reply *next = sim->head->next;
+
+        free(sim->head);
+        sim->head = next;
+    }
+    sim->tail = NULL;
+}
+
+/* Write the replies that are due. Return negative if the client is gone. */
+static int send_replies(struct sim *sim, int fd, long long now)
+{
+    while (sim->head != NULL && sim->head->due <= now)
+    {
+        struct sim_reply *reply = sim->head;
+        size_t off = 0;
+
+        while (off < reply->len)
+        {
+            ssize_t n = write(fd, reply->data + off, reply->len - off);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return -1;
+            }
+            off += n;
+        }
+        sim->head = reply->next;
+        if (sim->head == NULL)
+        {
+            sim->tail = NULL;
+        }
+        free(reply);
+    }
+    return 0;
+}
+
+/* Duty cycle at 'now', it falls by 1% every 'decay' ms */
+static double sim_duty(struct sim *sim, long long now)
+{
+    sim->duty -= (double)(now - sim->duty_time) / sim->decay;
+    if (sim->duty < 0)
+    {
+        sim->duty = 0;
+    }
+    sim->duty_time = now;
+    return sim->duty;
+}
+
+/* The valve opens in proportion to the missing temperature */
+static void set_valve(struct sim_device *dev)
+{
+    int diff = dev->setpoint * 5 - dev->actual;
+
+    dev->valve = (diff > 0) ? (diff * 10 > 100 ? 100 : diff * 10) : 0;
+}
+
+/* Set point of the weekly program at the current time */
+static int program_setpoint(struct sim_device *dev)
+{
+    time_t timer = time(NULL);
+    struct tm *tm_info = localtime(&timer);
+    /* The program starts on Saturday */
+    unsigned char *day = dev->program[(tm_info->tm_wday + 1) % MAX_WEEK_DAYS];
+    int t = (tm_info->tm_hour * 60 + tm_info->tm_min) / 5;
+    int i;
+
+    for (i = 0; i < MAX_DAY_SETPOINTS * 2 - 2; i += 2)
+    {
+        if ((((day[i] & 0x01) << 8) | day[i + 1]) > t)
+        {
+            break;
+        }
+    }
+    return day[i] >> 1;
+}
+
+static void init_devices(struct sim *sim)
+{
+    int i, d, s;
+
+    for (i = 0; i < sim->ndev; i++)
+    {
+        struct sim_device *dev = &sim->dev[i];
+
+        memset(dev, 0, sizeof(*dev));
+        dev->rf_address = SIM_DEVICE_RF + i;
+        dev->room_id = i % sim->nrooms + 1;
+        dev->mode = AutoTempMode;
+        dev->comfort = 45;
+        dev->eco = 38;
+        for (d = 0; d < MAX_WEEK_DAYS; d++)
+        {
+            /* 20.0 until 06:30, then 22.5 until 24:00 */
+            dev->program[d][0] = 40 << 1;
+            dev->program[d][1] = 78;
+            for (s = 2; s < MAX_DAY_SETPOINTS * 2; s += 2)
+            {
+                dev->program[d][s] = (45 << 1) | 1;
+                dev->program[d][s + 1] = 0x20;
+            }
+        }
+        dev->setpoint = program_setpoint(dev);
+        /* Rooms start a bit colder or warmer than asked */
+        dev->actual = dev->setpoint * 5 - 10 + (i % 5) * 5;
+        set_valve(dev);
+    }
+}
+
+/* Move the room temperatures towards the set points */
+static void update_devices(struct sim *sim)
+{
+    int i;
+
+    for (i = 0; i < sim->ndev; i++)
+    {
+        struct sim_device *dev = &sim->dev[i];
+        int diff;
+
+        if (dev->mode == AutoTempMode)
+        {
+            dev->setpoint = program_setpoint(dev);
+        }
+        diff = dev->setpoint * 5 - dev->actual;
+        dev->actual += (diff > 0) - (diff < 0);
+        set_valve(dev);
+    }
+}
+
+/* Append message type, payload encoded in base64 and terminator */
+static size_t put_b64_msg(char *out, const char *prefix,
+        const unsigned char *data, size_t data_sz)
+{
+    size_t len = strlen(prefix);
+
+    memcpy(out, prefix, len);
+    len += hex_to_base64_buf(data, data_sz, out + len,
+                             BASE64_ENCODED_SZ(data_sz));
+    memcpy(out + len, MSG_END, MSG_END_LEN);
+    return len + MSG_END_LEN;
+}
+
+/* Largest L message */
+#define SIM_L_MSG_SZ (8 + BASE64_ENCODED_SZ(SIM_DEVICES_MAX * 12))
+
+/* Write the device list message in 'out' */
+static size_t put_device_list(struct sim *sim, char *out)
+{
+    unsigned char l_data[SIM_DEVICES_MAX * 12], *l = l_data;
+    int i;
+
+    for (i = 0; i < sim->ndev; i++)
+    {
+        struct sim_device *dev = &sim->dev[i];
+
+        l[0] = 11;
+        l[1] = dev->rf_address >> 16;
+        l[2] = dev->rf_address >> 8;
+        l[3] = dev->rf_address;
+        l[4] = 0;
+        l[5] = 0x12;
+        l[6] = 0x18 | dev->mode;
+        l[7] = dev->valve;
+        l[8] = dev->setpoint;
+        /* Actual temperature in auto mode, 'until' date otherwise */
+        l[9] = (dev->mode == AutoTempMode) ? (dev->actual >> 8) & 0x01 : 0;
+        l[10] = (dev->mode == AutoTempMode) ? dev->actual & 0xff : 0;
+        l[11] = 0;
+        l += 12;
+    }
+    return put_b64_msg(out, "L:", l_data, l - l_data);
+}
+
+/* Build the Hello burst sent when a client connects: H, M, C for the cube
+ * and every device, L */
+static char* build_hello(struct sim *sim, size_t *size)
+{
+    unsigned char c_data[sizeof(union C_Data_Device) +
+                         sizeof(((union C_Data_Config*)0)->rtc)];
+    unsigned char *m_data, *m;
+    char *hello, *p, prefix[16], date[16];
+    time_t timer = time(NULL);
+    struct tm *tm_info = localtime(&timer);
+    int i, r;
+
+    hello = malloc(1024 + sim->ndev * 600 + SIM_L_MSG_SZ);
+    m_data = malloc(64 + sim->nrooms * 40 + sim->ndev * 40);
+    if (hello == NULL || m_data == NULL)
+    {
+        free(hello);
+        free(m_data);
+        return NULL;
+    }
+    p = hello;
+    strftime(date, sizeof(date), "%y%m%d,%H%M", tm_info);
+    p += sprintf(p, "H:%.10s,%06x,0113,00000000,4c4e0e3d,%02x,%02x,%.6s,"
+                    "%.4s,03,0000" MSG_END, sim->serial, SIM_RF_ADDRESS,
+                 (int)sim_duty(sim, now_ms()), SIM_FREE_SLOTS, date,
+                 date + 7);
+
+    /* Metadata: rooms, then devices with their room */
+    m = m_data;
+    *m++ = 'V';
+    *m++ = 0x02;
+    *m++ = sim->nrooms;
+    for (r = 1; r <= sim->nrooms; r++)
+    {
+        uint32_t rf = SIM_DEVICE_RF + r - 1;
+
+        *m++ = r;
+        *m = sprintf((char*)m + 1, "Room%d", r);
+        m += *m + 1;
+        *m++ = rf >> 16; *m++ = rf >> 8; *m++ = rf;
+    }
+    *m++ = sim->ndev;
+    for (i = 0; i < sim->ndev; i++)
+    {
+        struct sim_device *dev = &sim->dev[i];
+
+        *m++ = RadiatorThermostat;
+        *m++ = dev->rf_address >> 16;
+        *m++ = dev->rf_address >> 8;
+        *m++ = dev->rf_address;
+        m += sprintf((char*)m, "KEQ%07d", i);
+        *m = sprintf((char*)m + 1, "Thermostat%d", i + 1);
+        m += *m + 1;
+        *m++ = dev->room_id;
+    }
+    *m++ = 0x01;
+    p += put_b64_msg(p, "M:00,01,", m_data, m - m_data);
+    free(m_data);
+
+    /* The cube itself */
+    memset(c_data, 0, sizeof(c_data));
+    c_data[0] = sizeof(union C_Data_Device) - 1;
+    c_data[1] = SIM_RF_ADDRESS >> 16;
+    c_data[2] = (SIM_RF_ADDRESS >> 8) & 0xff;
+    c_data[3] = SIM_RF_ADDRESS & 0xff;
+    memcpy(c_data + 8, sim->serial, 10);
+    sprintf(prefix, "C:%06x,", SIM_RF_ADDRESS);
+    p += put_b64_msg(p, prefix, c_data, sizeof(union C_Data_Device) + 68);
+
+    for (i = 0; i < sim->ndev; i++)
+    {
+        struct sim_device *dev = &sim->dev[i];
+        union C_Data_Device *cd = (union C_Data_Device*)c_data;
+        union C_Data_Config *cfg =
+            (union C_Data_Config*)(c_data + sizeof(union C_Data_Device));
+
+        memset(c_data, 0, sizeof(c_data));
+        cd->device.Data_Length[0] = sizeof(c_data) - 1;
+        cd->device.Address_of_device[0] = dev->rf_address >> 16;
+        cd->device.Address_of_device[1] = dev->rf_address >> 8;
+        cd->device.Address_of_device[2] = dev->rf_address;
+        cd->device.Device_Type[0] = RadiatorThermostat;
+        cd->device.Room_ID[0] = dev->room_id;
+        cd->device.Firmware_version[0] = 0x10;
+        cd->device.Test_Result[0] = 0xff;
+        snprintf(cd->device.Serial_Number, sizeof(c_data) - 8, "KEQ%07d", i);
+        cfg->rtc.Comfort_Temperature[0] = dev->comfort;
+        cfg->rtc.Eco_Temperature[0] = dev->eco;
+        cfg->rtc.Max_Set_Point_Temperature[0] = 61;
+        cfg->rtc.Min_Set_Point_Temperature[0] = 9;
+        cfg->rtc.Temperature_offset[0] = 7;
+        cfg->rtc.Window_Open_Temperature[0] = 24;
+        cfg->rtc.Window_Open_Duration[0] = 3;
+        cfg->rtc.Boost[0] = 0x19;
+        cfg->rtc.Decalcification[0] = 0x0c;
+        cfg->rtc.Max_Valve_Setting[0] = 0xff;
+        memcpy(cfg->rtc.Weekly_Program, dev->program, sizeof(dev->program));
+        sprintf(prefix, "C:%06x,", dev->rf_address);
+        p += put_b64_msg(p, prefix, c_data, sizeof(c_data));
+    }
+    p += put_device_list(sim, p);
+    *size = p - hello;
+    return hello;
+}
+
+static struct sim_device* find_device(struct sim *sim, const unsigned char *rf)
+{
+    uint32_t rf_address = (rf[0] << 16) | (rf[1] << 8) | rf[2];
+    int i;
+
+    for (i = 0; i < sim->ndev; i++)
+    {
+        if (sim->dev[i].rf_address == rf_address)
+        {
+            return &sim->dev[i];
+        }
+    }
+    return NULL;
+}
+
+/* Store the set points of a program data command. The cube pads the day
+ * with the last set point. */
+static void set_program(struct sim_device *dev,
+        const struct s_Program_Data *s_P_D)
+{
+    unsigned char *day = dev->program[s_P_D->Day_of_week[0] % MAX_WEEK_DAYS];
+    int i, len = 0;
+
+    while (len < sizeof(s_P_D->Temp_and_Time) &&
+           (s_P_D->Temp_and_Time[len] || s_P_D->Temp_and_Time[len + 1]))
+    {
+        len += 2;
+    }
+    if (len == 0)
+    {
+        return;
+    }
+    memcpy(day, s_P_D->Temp_and_Time, len);
+    for (i = len; i < MAX_DAY_SETPOINTS * 2; i += 2)
+    {
+        day[i] = day[len - 2];
+        day[i + 1] = day[len - 1];
+    }
+}
+
+static void set_temp_mode(struct sim_device *dev, unsigned char temp_mode)
+{
+    dev->mode = temp_mode >> 6;
+    if (dev->mode == AutoTempMode && (temp_mode & 0x3f) == 0)
+    {
+        dev->setpoint = program_setpoint(dev);
+    }
+    else
+    {
+        dev->setpoint = temp_mode & 0x3f;
+    }
+}
+
+/* Apply an 's' command to the devices. Return negative if it is not
+ * understood. */
+static int apply_s_cmd(struct sim *sim, const unsigned char *data, int len)
+{
+    const struct s_Header_Data *s_H_D = (const struct s_Header_Data*)data;
+    struct sim_device *dev;
+    int i;
+
+    if (len < sizeof(*s_H_D))
+    {
+        return -1;
+    }
+    dev = find_device(sim, s_H_D->RF_Address);
+    switch (base_string_index(s_H_D->Base_String))
+    {
+        case ProgramData:
+            if (dev == NULL || len < sizeof(struct s_Program_Data))
+            {
+                return -1;
+            }
+            set_program(dev, (const struct s_Program_Data*)data);
+            break;
+        case EcoModeTemperature:
+        {
+            const struct s_Eco_Temp_Data *s_E_T_D =
+                (const struct s_Eco_Temp_Data*)data;
+
+            if (dev == NULL || len < sizeof(*s_E_T_D))
+            {
+                return -1;
+            }
+            dev->comfort = s_E_T_D->Temperature_Comfort[0];
+            dev->eco = s_E_T_D->Temperature_Eco[0];
+            break;
+        }
+        case TemperatureAndMode:
+        {
+            const struct s_Temp_Mode_Data *s_T_M_D =
+                (const struct s_Temp_Mode_Data*)data;
+
+            if (len < sizeof(*s_T_M_D))
+            {
+                return -1;
+            }
+            if (s_T_M_D->Base_String[BS_FLAGS] & BS_FLAG_GROUP)
+            {
+                /* Every device of the room */
+                for (i = 0; i < sim->ndev; i++)
+                {
+                    if (sim->dev[i].room_id == s_T_M_D->Room_Nr[0])
+                    {
+                        set_temp_mode(&sim->dev[i],
+                                      s_T_M_D->Temp_and_Mode[0]);
+                    }
+                }
+            }
+            else if (dev != NULL)
+            {
+                set_temp_mode(dev, s_T_M_D->Temp_and_Mode[0]);
+            }
+            else
+            {
+                return -1;
+            }
+            break;
+        }
+        default:
+            /* Accepted without effect */
+            break;
+    }
+    return 0;
+}
+
+/* Handle an 's' command and queue its 'S' reply. The command is rejected
+ * when the duty cycle budget is used up, otherwise it waits for the radio. */
+static int handle_s_cmd(struct sim *sim, const char *b64, int len,
+        long long now)
+{
+    unsigned char data[sizeof(struct s_Program_Data) + 16];
+    char reply[sizeof(struct S_Data) + 8];
+    double duty = sim_duty(sim, now);
+    int n, rejected;
+    long long due;
+
+    n = base64_to_hex_buf(b64, len, data, sizeof(data));
+    rejected = (duty + sim->cost > SIM_DUTY_MAX);
+    sim->commands++;
+    if (rejected)
+    {
+        sim->rejected++;
+        due = now + reply_delay(sim);
+    }
+    else
+    {
+        if (n < 0 || apply_s_cmd(sim, data, n) < 0)
+        {
+            printf("Error : bad 's' command %.*s\n", len, b64);
+        }
+        sim->duty += sim->cost;
+        if (sim->radio_free < now)
+        {
+            sim->radio_free = now;
+        }
+        sim->radio_free += sim->radio;
+        due = sim->radio_free + reply_delay(sim);
+    }
+    n = sprintf(reply, "S:%02x,%d,%02x" MSG_END, (int)sim->duty, rejected,
+                SIM_FREE_SLOTS);
+    if (sim->verbose)
+    {
+        printf("s:%.*s -> %.*s\n", len, b64, n - MSG_END_LEN, reply);
+    }
+    return queue_reply(sim, reply, n, due);
+}
+
+/* Handle one message from the client. Return 1 when the client quits. */
+static int handle_msg(struct sim *sim, const char *msg, int len,
+        long long now)
+{
+    if (len < 2 || msg[1] != ':')
+    {
+        return 0;
+    }
+    switch (msg[0])
+    {
+        case 's':
+            return handle_s_cmd(sim, msg + 2, len - 2, now);
+        case 'l':
+        {
+            char *l_msg = malloc(SIM_L_MSG_SZ);
+            int res;
+
+            if (l_msg == NULL)
+            {
+                return -1;
+            }
+            update_devices(sim);
+            res = queue_reply(sim, l_msg, put_device_list(sim, l_msg),
+                              now + reply_delay(sim));
+            free(l_msg);
+            return res;
+        }
+        case 'q':
+            return 1;
+        default:
+            if (sim->verbose)
+            {
+                printf("ignored %.*s\n", len, msg);
+            }
+            return 0;
+    }
+}
+
+/* Return the terminator of the first message in [p, end), NULL if the
+ * message is not complete */
+static char* find_msg_end(char *p, char *end)
+{
+    while ((p = memchr(p, MSG_END[0], end - p)) != NULL)
+    {
+        if (p + 1 < end && p[1] == MSG_END[1])
+        {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Answer a discovery probe for any cube or for our serial number */
+static void serve_discovery(struct sim *sim, int udp)
+{
+    /* Probe: header, serial number or '*' for any cube, request type */
+    static const char probe[] = "eQ3Max*\0";
+    const int hdr_len = sizeof(probe) - 1;
+    struct Discover_Data D_Data;
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    char pkt[64];
+    ssize_t n;
+
+    n = recvfrom(udp, pkt, sizeof(pkt), 0, (struct sockaddr*)&sin, &sin_len);
+    if (n != hdr_len + SERIAL_LEN + 1 || memcmp(pkt, probe, hdr_len) != 0 ||
+        pkt[hdr_len + SERIAL_LEN] != 'I' ||
+        (memcmp(pkt + hdr_len, "**********", SERIAL_LEN) != 0 &&
+         memcmp(pkt + hdr_len, sim->serial, SERIAL_LEN) != 0))
+    {
+        return;
+    }
+    memset(&D_Data, 0, sizeof(D_Data));
+    memcpy(D_Data.Name, "eQ3MaxAp", sizeof(D_Data.Name));
+    memcpy(D_Data.Serial_number, sim->serial, SERIAL_LEN);
+    D_Data.Request_Type[0] = 'I';
+    D_Data.RF_address[0] = SIM_RF_ADDRESS >> 16;
+    D_Data.RF_address[1] = (SIM_RF_ADDRESS >> 8) & 0xff;
+    D_Data.RF_address[2] = SIM_RF_ADDRESS & 0xff;
+    D_Data.Firmware_version[0] = 0x01;
+    D_Data.Firmware_version[1] = 0x13;
+    if (sim->verbose)
+    {
+        printf("discovery from %s\n", inet_ntoa(sin.sin_addr));
+    }
+    sendto(udp, &D_Data, sizeof(D_Data), 0, (struct sockaddr*)&sin, sin_len);
+}
+
+/* Serve a connected client until it quits or closes the connection */
+static void serve_client(struct sim *sim, int fd, int udp)
+{
+    char rx[SIM_RX_SZ];
+    size_t rx_len = 0;
+    char *hello;
+    size_t size;
+    int quit = 0;
+
+    hello = build_hello(sim, &size);
+    if (hello == NULL || queue_reply(sim, hello, size,
+                                     now_ms() + reply_delay(sim)) < 0)
+    {
+        free(hello);
+        return;
+    }
+    free(hello);
+
+    /* Pending replies are still sent after 'q:' */
+    while (!quit || sim->head != NULL)
+    {
+        struct pollfd pfd[2];
+        long long now = now_ms();
+        int tmo = -1;
+
+        if (send_replies(sim, fd, now) < 0)
+        {
+            break;
+        }
+        if (sim->head != NULL)
+        {
+            tmo = sim->head->due - now;
+        }
+        pfd[0].fd = quit ? -1 : fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = udp;
+        pfd[1].events = POLLIN;
+        if (poll(pfd, 2, tmo) < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            serve_discovery(sim, udp);
+        }
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = read(fd, rx + rx_len, sizeof(rx) - rx_len);
+            char *msg = rx, *end;
+
+            if (n <= 0)
+            {
+                break;
+            }
+            rx_len += n;
+            now = now_ms();
+            while (!quit && (end = find_msg_end(msg, rx + rx_len)) != NULL)
+            {
+                quit = handle_msg(sim, msg, end - msg, now);
+                msg = end + MSG_END_LEN;
+            }
+            if (quit < 0)
+            {
+                break;
+            }
+            rx_len -= msg - rx;
+            memmove(rx, msg, rx_len);
+            if (rx_len == sizeof(rx))
+            {
+                printf("Error : message too long\n");
+                break;
+            }
+        }
+    }
+    drop_replies(sim);
+}
+
+/* Bind the discovery port, probes are sent to the broadcast and multicast
+ * addresses */
+static int open_discovery(void)
+{
+    struct sockaddr_in sin;
+    struct ip_mreq mreq;
+    int sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int on = 1;
+
+    if (sd < 0)
+    {
+        return -1;
+    }
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(MAX_DISCOVER_PORT);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    /* maxctl binds the same port to receive the replies */
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(sd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+    {
+        close(sd);
+        return -1;
+    }
+    /* Without multicast the broadcast probes are still received */
+    inet_pton(AF_INET, MAX_MCAST_ADDR, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    return sd;
+}
+
+static int open_listener(const char *addr, int port)
+{
+    struct sockaddr_in sin;
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+
+    if (sd < 0)
+    {
+        return -1;
+    }
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1 ||
+        setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(sd, (struct sockaddr*)&sin, sizeof(sin)) < 0 ||
+        listen(sd, 8) < 0)
+    {
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [options]\n"
+           "  -n devices   simulated thermostats, 1 to %d (default %d)\n"
+           "  -g rooms     rooms the thermostats are spread over (default %d)\n"
+           "  -b address   address of the TCP port (default any)\n"
+           "  -p port      TCP port (default %d)\n"
+           "  -s serial    serial number of the cube (default %s)\n"
+           "  -l ms        round trip time added to every reply\n"
+           "  -j ms        random jitter added to the round trip time\n"
+           "  -r ms        air time of one 's' command, commands queue for "
+           "the radio\n"
+           "  -c percent   duty cycle used by one 's' command (default %.1f)\n"
+           "  -d ms        time for the duty cycle to fall by 1%% "
+           "(default %d)\n"
+           "  -D percent   initial duty cycle\n"
+           "  -U           do not answer discovery probes\n"
+           "  -v           print the commands and replies\n",
+           name, SIM_DEVICES_MAX, SIM_DEVICES, SIM_ROOMS, MAX_TCP_PORT,
+           SIM_SERIAL, SIM_COST, SIM_DUTY_DECAY_MS);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sim sim;
+    const char *addr = "0.0.0.0";
+    int port = MAX_TCP_PORT, discovery = 1;
+    int opt, sd, udp = -1, on = 1;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.serial = SIM_SERIAL;
+    sim.ndev = SIM_DEVICES;
+    sim.nrooms = SIM_ROOMS;
+    sim.cost = SIM_COST;
+    sim.decay = SIM_DUTY_DECAY_MS;
+
+    while ((opt = getopt(argc, argv, "n:g:b:p:s:l:j:r:c:d:D:Uv")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                sim.ndev = atoi(optarg);
+                break;
+            case 'g':
+                sim.nrooms = atoi(optarg);
+                break;
+            case 'b':
+                addr = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 's':
+                sim.serial = optarg;
+                break;
+            case 'l':
+                sim.rtt = atoi(optarg);
+                break;
+            case 'j':
+                sim.jitter = atoi(optarg);
+                break;
+            case 'r':
+                sim.radio = atoi(optarg);
+                break;
+            case 'c':
+                sim.cost = atof(optarg);
+                break;
+            case 'd':
+                sim.decay = atoi(optarg);
+                break;
+            case 'D':
+                sim.duty = atof(optarg);
+                break;
+            case 'U':
+                discovery = 0;
+                break;
+            case 'v':
+                sim.verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (sim.ndev < 1 || sim.ndev > SIM_DEVICES_MAX || sim.nrooms < 1 ||
+        sim.nrooms > sim.ndev || strlen(sim.serial) != SERIAL_LEN ||
+        sim.rtt < 0 || sim.jitter < 0 || sim.radio < 0 || sim.cost < 0 ||
+        sim.decay < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim.dev = calloc(sim.ndev, sizeof(*sim.dev));
+    if (sim.dev == NULL)
+    {
+        return 1;
+    }
+    init_devices(&sim);
+    sim.duty_time = now_ms();
+    srand(time(NULL));
+    /* Replies to a client that went away must not kill us */
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    sd = open_listener(addr, port);
+    if (sd < 0)
+    {
+        perror("Error : cannot listen");
+        return 1;
+    }
+    if (discovery && (udp = open_discovery()) < 0)
+    {
+        perror("Error : cannot bind the discovery port");
+        return 1;
+    }
+    printf("maxsim %s: %d devices in %d rooms on %s:%d\n", sim.serial,
+           sim.ndev, sim.nrooms, addr, port);
+
+    /* Like a cube, one client at a time */
+    for (;;)
+    {
+        struct pollfd pfd[2];
+
+        pfd[0].fd = sd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = udp;
+        pfd[1].events = POLLIN;
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            serve_discovery(&sim, udp);
+        }
+        if (pfd[0].revents & POLLIN)
+        {
+            int fd = accept(sd, NULL, NULL);
+
+            if (fd < 0)
+            {
+                continue;
+            }
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            sim.commands = 0;
+            sim.rejected = 0;
+            serve_client(&sim, fd, udp);
+            close(fd);
+            printf("session done: %ld commands, %ld rejected, duty %d%%\n",
+                   sim.commands, sim.rejected, (int)sim_duty(&sim, now_ms()));
+        }
+    }
+    close(sd);
+    if (udp >= 0)
+    {
+        close(udp);
+    }
+    free(sim.dev);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+#include <stdio.h>
+
+#include "simconf.h"
+
+static const char *week_day_name[] = {"saturday", "sunday", "monday",
+    "tuesday", "wednesday", "thursday", "friday"};
+
+int write_sim_config(FILE *fp, int ndev, int nrooms, int step)
+{
+    int i, d;
+
+    for (i = 0; i < ndev; i++)
+    {
+        fprintf(fp, "device %06x {\n    room %d;\n    eco 19;\n"
+                    "    comfort 22.5;\n    auto {\n",
+                SIM_DEVICE_RF + i, i % nrooms + 1);
+        for (d = 0; d < 7; d++)
+        {
+            /* 20.0 until 06:30, then 22.5 until 24:00 like maxsim */
+            fprintf(fp, "         %s {\n             20.0 06:30;\n",
+                    week_day_name[d]);
+            if (d == 2 && step > 0 && i % step == step - 1)
+            {
+                fprintf(fp, "             22.5 08:00;\n"
+                            "             20.0 14:00;\n");
+            }
+            fprintf(fp, "             22.5 24:00;\n         };\n");
+        }
+        fprintf(fp, "    };\n};\n\n");
+    }
+    return ferror(fp) ? -1 : 0;
+}
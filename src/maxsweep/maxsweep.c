@@ -0,0 +1,604 @@
+/* Copyright (c) 2015, Costin Popescu
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */ 
+
+/* maxsweep runs maxctl against maxsim over a grid of installation sizes,
+ * round trip times, command windows and duty cycle budgets, and reports the
+ * wall time, CPU time and system calls of each 'get status' and
+ * 'set program' run. Every run gets a fresh simulator so that 'set program'
+ * always has the same commands to send. */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include "simconf.h"
+
+#define SWEEP_LIST_MAX 16
+#define SWEEP_PORT 62920     /* TCP port of the simulator */
+#define SWEEP_DEVICES_MAX 255 /* most devices maxsim simulates */
+#define SWEEP_ROOMS 8
+#define SWEEP_TMO 120        /* seconds before a run is killed */
+#define SWEEP_SIM_TMO 2000   /* ms to wait for the simulator output */
+
+struct sweep_list {
+    int count;
+    int value[SWEEP_LIST_MAX];
+};
+
+enum sweep_op
+{
+    SweepGet = 0,
+    SweepSet = 1
+};
+
+static const char *op_name[] = {"get", "set"};
+
+/* Parameters of one run */
+struct sweep_run {
+    int op;
+    int ndev;
+    int rtt;
+    int window;
+    int duty;
+};
+
+struct sweep_result {
+    int status;             /* exit status of maxctl, -1 if killed */
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    long syscalls;          /* -1 if not counted */
+    long commands;          /* 's' commands seen by the simulator */
+    long rejected;
+};
+
+/* SIGCHLD is blocked in the sweep, not in the programs it runs */
+static void unblock_signals(void)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+/* A running simulator and its output */
+struct sim_proc {
+    pid_t pid;
+    int fd;
+    char buf[1024];
+    size_t len;
+};
+
+static const char *bin_dir = ".";
+static int port = SWEEP_PORT;
+static int jitter = 0;
+static int radio = 0;
+static int run_tmo = SWEEP_TMO;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Parse a comma separated list of numbers between 'min' and 'max' */
+static int read_list(const char *arg, struct sweep_list *list, int min,
+        int max)
+{
+    char *end;
+    long n;
+
+    list->count = 0;
+    while (*arg != '\0' && list->count < SWEEP_LIST_MAX)
+    {
+        n = strtol(arg, &end, 10);
+        if (end == arg || n < min || n > max ||
+            (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        list->value[list->count++] = n;
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return (list->count > 0 && *arg == '\0') ? 0 : -1;
+}
+
+/* Write a configuration for the 'ndev' devices of maxsim. The monday program
+ * differs from the simulated one, 'set program' sends one command per
+ * device. */
+static int write_config(int ndev, char *path)
+{
+    FILE *fp;
+    int fd, res;
+
+    fd = mkstemp(path);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+    {
+        return -1;
+    }
+    /* Same rooms as maxsim */
+    res = write_sim_config(fp, ndev, ndev < SWEEP_ROOMS ? ndev : SWEEP_ROOMS,
+                           1);
+    return (fclose(fp) != 0) ? -1 : res;
+}
+
+/* Read a line of the simulator output starting with 'prefix'. Return
+ * negative if none comes within SWEEP_SIM_TMO. */
+static int read_sim_line(struct sim_proc *sim, const char *prefix,
+        char *line, size_t size)
+{
+    double deadline = now_ms() + SWEEP_SIM_TMO;
+
+    for (;;)
+    {
+        struct pollfd pfd;
+        char *eol;
+        ssize_t n;
+        int left;
+
+        while ((eol = memchr(sim->buf, '\n', sim->len)) != NULL)
+        {
+            size_t used = eol + 1 - sim->buf;
+            int match;
+
+            *eol = '\0';
+            match = (strncmp(sim->buf, prefix, strlen(prefix)) == 0);
+            if (match)
+            {
+                size_t len = strlen(sim->buf);
+
+                len = (len < size) ? len : size - 1;
+                memcpy(line, sim->buf, len);
+                line[len] = '\0';
+            }
+            memmove(sim->buf, eol + 1, sim->len - used);
+            sim->len -= used;
+            if (match)
+            {
+                return 0;
+            }
+        }
+        if (sim->len == sizeof(sim->buf))
+        {
+            sim->len = 0;
+        }
+        left = deadline - now_ms();
+        pfd.fd = sim->fd;
+        pfd.events = POLLIN;
+        if (left <= 0 || poll(&pfd, 1, left) <= 0)
+        {
+            return -1;
+        }
+        n = read(sim->fd, sim->buf + sim->len, sizeof(sim->buf) - sim->len);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        sim->len += n;
+    }
+}
+
+static int start_sim(struct sim_proc *sim, const struct sweep_run *run)
+{
+    char path[512], ndev[16], rooms[16], port_s[16], rtt[16], jitter_s[16],
+         radio_s[16], duty[16], line[256];
+    int fds[2];
+
+    snprintf(path, sizeof(path), "%s/maxsim", bin_dir);
+    snprintf(ndev, sizeof(ndev), "%d", run->ndev);
+    snprintf(rooms, sizeof(rooms), "%d",
+             run->ndev < SWEEP_ROOMS ? run->ndev : SWEEP_ROOMS);
+    snprintf(port_s, sizeof(port_s), "%d", port);
+    snprintf(rtt, sizeof(rtt), "%d", run->rtt);
+    snprintf(jitter_s, sizeof(jitter_s), "%d", jitter);
+    snprintf(radio_s, sizeof(radio_s), "%d", radio);
+    snprintf(duty, sizeof(duty), "%d", run->duty);
+    if (pipe(fds) < 0)
+    {
+        return -1;
+    }
+    memset(sim, 0, sizeof(*sim));
+    sim->pid = fork();
+    if (sim->pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (sim->pid == 0)
+    {
+        unblock_signals();
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(path, path, "-n", ndev, "-g", rooms, "-b", "127.0.0.1",
+              "-p", port_s, "-l", rtt, "-j", jitter_s, "-r", radio_s,
+              "-D", duty, "-U", (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    sim->fd = fds[0];
+    /* Listening once it has printed its banner */
+    if (read_sim_line(sim, "maxsim", line, sizeof(line)) < 0)
+    {
+        fprintf(stderr, "Error : %s did not start\n", path);
+        kill(sim->pid, SIGTERM);
+        waitpid(sim->pid, NULL, 0);
+        close(sim->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Stop the simulator after the session, collecting its command counts */
+static void stop_sim(struct sim_proc *sim, struct sweep_result *res)
+{
+    char line[256];
+
+    if (read_sim_line(sim, "session done:", line, sizeof(line)) < 0 ||
+        sscanf(line, "session done: %ld commands, %ld rejected",
+               &res->commands, &res->rejected) != 2)
+    {
+        res->commands = res->rejected = -1;
+    }
+    kill(sim->pid, SIGTERM);
+    waitpid(sim->pid, NULL, 0);
+    close(sim->fd);
+}
+
+/* Start maxctl for a run, traced with ptrace if 'trace' is set */
+static pid_t start_maxctl(const struct sweep_run *run, const char *conf,
+        int trace)
+{
+    char path[512], window[16], port_s[16];
+    pid_t pid;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/maxctl", bin_dir);
+    snprintf(window, sizeof(window), "%d", run->window);
+    snprintf(port_s, sizeof(port_s), "%d", port);
+    pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+    unblock_signals();
+    /* The output of maxctl is not part of the measure */
+    fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if (trace && ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+    {
+        _exit(126);
+    }
+    if (run->op == SweepGet)
+    {
+        execl(path, path, "-w", window, "127.0.0.1", port_s, "get", "status",
+              (char*)NULL);
+    }
+    else
+    {
+        execl(path, path, "-w", window, "127.0.0.1", port_s, "set",
+              "program", "all", conf, (char*)NULL);
+    }
+    _exit(127);
+}
+
+/* Wait for maxctl, killing it after 'run_tmo' seconds. SIGCHLD is blocked,
+ * it tells when a child is done. */
+static int wait_maxctl(pid_t pid, struct rusage *ru)
+{
+    double deadline = now_ms() + run_tmo * 1000.0;
+    struct timespec ts;
+    sigset_t set;
+    int status;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    for (;;)
+    {
+        double left;
+
+        if (wait4(pid, &status, WNOHANG, ru) == pid)
+        {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        left = deadline - now_ms();
+        if (left <= 0)
+        {
+            kill(pid, SIGKILL);
+            wait4(pid, &status, 0, ru);
+            return -1;
+        }
+        ts.tv_sec = left / 1000;
+        ts.tv_nsec = ((long)left % 1000) * 1000000;
+        sigtimedwait(&set, NULL, &ts);
+    }
+}
+
+/* Count the system calls of a traced maxctl until it exits */
+static long count_syscalls(pid_t pid)
+{
+    long stops = 0;
+    int status, sig = 0;
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+    {
+        return -1;
+    }
+    /* Stopped at exec, system call stops are told from signals */
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    for (;;)
+    {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void*)(long)sig) < 0 ||
+            waitpid(pid, &status, 0) < 0)
+        {
+            return -1;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+        {
+            break;
+        }
+        sig = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+        {
+            stops++;
+        }
+        else if (WSTOPSIG(status) != SIGTRAP)
+        {
+            sig = WSTOPSIG(status);
+        }
+    }
+    /* One stop on entry and one on exit, exit_group has no exit stop */
+    return (stops + 1) / 2;
+}
+
+static int run_once(const struct sweep_run *run, const char *conf,
+        int trace, struct sweep_result *res)
+{
+    struct sim_proc sim;
+    struct rusage ru;
+    double start;
+    pid_t pid;
+
+    if (start_sim(&sim, run) < 0)
+    {
+        return -1;
+    }
+    start = now_ms();
+    pid = start_maxctl(run, conf, trace);
+    if (pid < 0)
+    {
+        stop_sim(&sim, res);
+        return -1;
+    }
+    if (trace)
+    {
+        res->syscalls = count_syscalls(pid);
+    }
+    else
+    {
+        memset(&ru, 0, sizeof(ru));
+        res->status = wait_maxctl(pid, &ru);
+        res->wall_ms = now_ms() - start;
+        res->user_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+        res->sys_ms = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+    }
+    stop_sim(&sim, res);
+    return 0;
+}
+
+static FILE *csv = NULL;
+
+static void report(const struct sweep_run *run, const struct sweep_result *res)
+{
+    printf("%-4s %5d %5d %6d %5d %5ld %5ld %4d %10.1f %8.1f %8.1f %9ld\n",
+           op_name[run->op], run->ndev, run->rtt, run->window, run->duty,
+           res->commands, res->rejected, res->status, res->wall_ms,
+           res->user_ms, res->sys_ms, res->syscalls);
+    fflush(stdout);
+    if (csv != NULL)
+    {
+        fprintf(csv, "%s,%d,%d,%d,%d,%ld,%ld,%d,%.1f,%.1f,%.1f,%ld\n",
+                op_name[run->op], run->ndev, run->rtt, run->window, run->duty,
+                res->commands, res->rejected, res->status, res->wall_ms,
+                res->user_ms, res->sys_ms, res->syscalls);
+    }
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [options]\n"
+           "  -n list   device counts, 1 to %d (default 1,10,50)\n"
+           "  -l list   round trip times in ms (default 0,20,100)\n"
+           "  -w list   command windows of maxctl (default 1,4,16)\n"
+           "  -D list   initial duty cycles of the cube in %% (default 0)\n"
+           "  -o ops    get, set or get,set (default)\n"
+           "  -j ms     reply jitter of the simulator\n"
+           "  -r ms     air time of one command in the simulator\n"
+           "  -b dir    directory of maxctl and maxsim (default .)\n"
+           "  -p port   TCP port of the simulator (default %d)\n"
+           "  -t secs   time after which a run is killed (default %d)\n"
+           "  -S        do not count the system calls\n"
+           "  -c file   also write the results to a CSV file\n",
+           name, SWEEP_DEVICES_MAX, SWEEP_PORT, SWEEP_TMO);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sweep_list devs = {3, {1, 10, 50}};
+    struct sweep_list rtts = {3, {0, 20, 100}};
+    struct sweep_list windows = {3, {1, 4, 16}};
+    struct sweep_list duties = {1, {0}};
+    int ops[2] = {1, 1}, trace = 1;
+    char conf[] = "/tmp/maxsweepXXXXXX";
+    sigset_t set;
+    int opt, d, l, w, u, op;
+
+    while ((opt = getopt(argc, argv, "n:l:w:D:o:j:r:b:p:t:Sc:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                if (read_list(optarg, &devs, 1, SWEEP_DEVICES_MAX) < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (read_list(optarg, &rtts, 0, 10000) < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                if (read_list(optarg, &windows, 1, 32) < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'D':
+                if (read_list(optarg, &duties, 0, 100) < 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'o':
+                ops[SweepGet] = (strstr(optarg, "get") != NULL);
+                ops[SweepSet] = (strstr(optarg, "set") != NULL);
+                if (!ops[SweepGet] && !ops[SweepSet])
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                jitter = atoi(optarg);
+                break;
+            case 'r':
+                radio = atoi(optarg);
+                break;
+            case 'b':
+                bin_dir = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                run_tmo = atoi(optarg);
+                break;
+            case 'S':
+                trace = 0;
+                break;
+            case 'c':
+                if ((csv = fopen(optarg, "w")) == NULL)
+                {
+                    perror(optarg);
+                    return 1;
+                }
+                fprintf(csv, "op,devices,rtt_ms,window,duty,commands,"
+                             "rejected,status,wall_ms,user_ms,sys_ms,"
+                             "syscalls\n");
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* wait_maxctl is woken up by SIGCHLD */
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    printf("%-4s %5s %5s %6s %5s %5s %5s %4s %10s %8s %8s %9s\n", "op",
+           "devs", "rtt", "window", "duty", "cmds", "rej", "rc", "wall(ms)",
+           "user", "sys", "syscalls");
+    for (d = 0; d < devs.count; d++)
+    {
+        strcpy(conf, "/tmp/maxsweepXXXXXX");
+        if (write_config(devs.value[d], conf) < 0)
+        {
+            perror("Error : cannot write the configuration");
+            return 1;
+        }
+        for (l = 0; l < rtts.count; l++)
+        {
+            for (u = 0; u < duties.count; u++)
+            {
+                for (op = SweepGet; op <= SweepSet; op++)
+                {
+                    for (w = 0; ops[op] && w < windows.count; w++)
+                    {
+                        struct sweep_run run;
+                        struct sweep_result res;
+
+                        /* The window only matters when sending commands */
+                        if (op == SweepGet && w > 0)
+                        {
+                            break;
+                        }
+                        run.op = op;
+                        run.ndev = devs.value[d];
+                        run.rtt = rtts.value[l];
+                        run.window = windows.value[w];
+                        run.duty = duties.value[u];
+                        memset(&res, 0, sizeof(res));
+                        res.syscalls = -1;
+                        if (run_once(&run, conf, 0, &res) < 0 ||
+                            (trace && res.status == 0 &&
+                             run_once(&run, conf, 1, &res) < 0))
+                        {
+                            unlink(conf);
+                            return 1;
+                        }
+                        report(&run, &res);
+                    }
+                }
+            }
+        }
+        unlink(conf);
+    }
+
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    return 0;
+}